@@ -0,0 +1,303 @@
+/*
+ * ChiSP is a PlayStation Portable emulator written in C++.
+ * Copyright (C) 2023  noumidev
+ */
+
+// Host microbenchmarks, drives core subsystems without firmware
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+
+#include "../core/config.hpp"
+#include "../core/dmacplus.hpp"
+#include "../core/ge.hpp"
+#include "../core/memory.hpp"
+#include "../core/scheduler.hpp"
+#include "../core/allegrex/allegrex.hpp"
+#include "../core/allegrex/interpreter.hpp"
+#include "../core/allegrex/jit.hpp"
+#include "../core/allegrex/opcodes.hpp"
+#include "../core/crypto/kirk.hpp"
+
+using namespace psp;
+
+using allegrex::Allegrex;
+
+constexpr u32 CODE_ADDR = 0x08100000;
+constexpr u32 DATA_ADDR = 0x08200000;
+constexpr u32 SRC_ADDR  = 0x08300000;
+constexpr u32 DST_ADDR  = 0x08400000;
+constexpr u32 LIST_ADDR = 0x08500000;
+constexpr u32 VTX_ADDR  = 0x08600000;
+
+Allegrex cpu;
+
+// Runs fn once to warm up, then ops times. Each op processes itemsPerOp items
+void measure(const char *name, const char *unit, u64 itemsPerOp, u64 ops, const std::function<void()> &fn) {
+    fn();
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (u64 i = 0; i < ops; i++) fn();
+
+    const auto end = std::chrono::steady_clock::now();
+
+    const auto ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    std::fprintf(stderr, "%-28s %12.1f ns/op %12.2f M%s/s\n", name, ns / ops, (1E3 * itemsPerOp * ops) / ns, unit);
+}
+
+// Dispatches the earliest pending event, this finishes the operation that was just started
+void finishEvent() {
+    scheduler::run(scheduler::getCyclesUntilNextEvent());
+}
+
+// MIPS encodings
+constexpr u32 rType(u32 rs, u32 rt, u32 rd, u32 shamt, u32 funct) {
+    return (rs << 21) | (rt << 16) | (rd << 11) | (shamt << 6) | funct;
+}
+
+constexpr u32 iType(u32 opcode, u32 rs, u32 rt, u32 imm) {
+    return (opcode << 26) | (rs << 21) | (rt << 16) | (imm & 0xFFFF);
+}
+
+// Endless ALU/load/store loop, it carries registers so it is never treated as idle
+void writeCodeStream() {
+    using namespace allegrex::interpreter;
+
+    const u32 code[] = {
+        iType(0x0F, 0, SP, DATA_ADDR >> 16), // LUI   SP, DATA_ADDR
+        iType(0x09, T0, T0, 1),              // ADDIU T0, T0, 1
+        rType(T1, T0, T1, 0, 0x26),          // XOR   T1, T1, T0
+        rType(0, T1, T2, 3, 0x00),           // SLL   T2, T1, 3
+        rType(T3, T2, T3, 0, 0x21),          // ADDU  T3, T3, T2
+        iType(0x2B, SP, T3, 0),              // SW    T3, 0(SP)
+        iType(0x23, SP, T4, 0),              // LW    T4, 0(SP)
+        rType(T5, T4, T5, 0, 0x21),          // ADDU  T5, T5, T4
+        iType(0x04, 0, 0, (u32)-8),          // BEQ   R0, R0, loop
+        0,                                   // NOP
+    };
+
+    for (u32 i = 0; i < sizeof(code) / sizeof(u32); i++) memory::write32(CODE_ADDR + 4 * i, code[i]);
+}
+
+void benchEngine(const char *name, void (*runCore)(Allegrex *)) {
+    cpu.setPC(CODE_ADDR);
+
+    i64 instrs = 0;
+
+    // Slices last config::maxSliceCycles, the bench event is far away
+    measure(name, "instr", config::maxSliceCycles, 1000, [&]() {
+        scheduler::getRunCycles();
+
+        runCore(&cpu);
+
+        instrs += cpu.cycles;
+
+        scheduler::endSlice();
+    });
+
+    std::fprintf(stderr, "%-28s %12lld instructions per slice\n", "", (long long)(instrs / 1001));
+}
+
+// Measures every engine so they can be compared, --cpu is ignored
+void benchInterpreter() {
+    writeCodeStream();
+
+    benchEngine("interpreter::run", &allegrex::interpreter::run);
+    benchEngine("interpreter::runCached", &allegrex::interpreter::runCached);
+
+    if (allegrex::jit::init()) benchEngine("jit::run", &allegrex::jit::run);
+
+    // Blocks are promoted during the warm-up run
+    benchEngine("jit::runTiered", &allegrex::jit::runTiered);
+}
+
+void benchMemory() {
+    struct Region {
+        const char *name;
+        u32 addr;
+    };
+
+    const Region regions[] = {
+        {"SPRAM", (u32)memory::MemoryBase::SPRAM},
+        {"EDRAM", (u32)memory::MemoryBase::EDRAM},
+        {"DRAM" , DATA_ADDR},
+        {"NAND DMACTRL", 0x1D101024},
+    };
+
+    char name[64];
+
+    for (const auto &region : regions) {
+        u32 sum = 0;
+
+        std::snprintf(name, sizeof(name), "read32 %s", region.name);
+
+        measure(name, "access", 1024, 1000, [&]() {
+            for (int i = 0; i < 1024; i++) sum += memory::read32(region.addr);
+        });
+
+        // Device registers have side effects on write
+        if (region.addr == 0x1D101024) continue;
+
+        std::snprintf(name, sizeof(name), "write32 %s", region.name);
+
+        measure(name, "access", 1024, 1000, [&]() {
+            for (int i = 0; i < 1024; i++) memory::write32(region.addr + 4 * (i & 0xFF), sum + i);
+        });
+    }
+}
+
+void benchScheduler() {
+    const auto idNop = scheduler::registerEvent([](int) {});
+
+    u32 seed = 1;
+
+    // 1024 events with pseudo-random delays, then dispatch all of them
+    measure("scheduler add+run", "event", 1024, 1000, [&]() {
+        for (int i = 0; i < 1024; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+
+            scheduler::addEvent(idNop, 0, 1 + (seed % 100000));
+        }
+
+        scheduler::run(100000);
+    });
+}
+
+// Builds a display list that draws prim with count vertices from VTX_ADDR
+void writeDisplayList(u32 prim, u32 count) {
+    const u32 list[] = {
+        0x10080000,                     // BASE 0x08000000
+        0x9C000000,                     // FBP 0
+        0x9D000000 | 512,               // FBW 512
+        0xD4000000,                     // SCISSOR1 0, 0
+        0xD5000000 | (271 << 10) | 479, // SCISSOR2 479, 271
+        0xD6000000,                     // MINZ 0
+        0xD700FFFF,                     // MAXZ 0xFFFF
+        0x23000000,                     // ZTE 0
+        0x1E000000,                     // TME 0
+        0x50000001,                     // SHADE gouraud
+        0x12000000 | (1 << 23) | (2 << 7) | (7 << 2), // VTYPE through, s16 position, RGBA8888 color
+        0x01000000 | (VTX_ADDR & 0xFFFFFF), // VADR
+        0x04000000 | (prim << 16) | count,  // PRIM
+        0x0C000000,                     // END
+    };
+
+    for (u32 i = 0; i < sizeof(list) / sizeof(u32); i++) memory::write32(LIST_ADDR + 4 * i, list[i]);
+}
+
+// Color followed by a padded s16 position
+void writeVertex(int idx, u32 color, i16 x, i16 y) {
+    const auto addr = VTX_ADDR + 12 * idx;
+
+    memory::write32(addr + 0, color);
+    memory::write16(addr + 4, x);
+    memory::write16(addr + 6, y);
+    memory::write16(addr + 8, 0);
+    memory::write16(addr + 10, 0);
+}
+
+void runDisplayList() {
+    memory::write32(0x1D400108, LIST_ADDR); // LISTADDR
+    memory::write32(0x1D400100, 1);         // CONTROL, starts the list
+
+    finishEvent();
+}
+
+void benchGE() {
+    constexpr u32 PRIM_TRIANGLESTRIP = 4;
+    constexpr u32 PRIM_SPRITE = 6;
+
+    writeVertex(0, 0xFF0000FF,   0,   0);
+    writeVertex(1, 0xFF00FF00, 479,   0);
+    writeVertex(2, 0xFFFF0000,   0, 271);
+
+    writeDisplayList(PRIM_TRIANGLESTRIP, 3);
+
+    measure("ge::drawTriangle (half)", "pixel", 480 * 272 / 2, 100, &runDisplayList);
+
+    writeVertex(0, 0xFFFFFFFF,   0,   0);
+    writeVertex(1, 0xFFFFFFFF, 480, 272);
+
+    writeDisplayList(PRIM_SPRITE, 2);
+
+    measure("ge::drawSprite (full)", "pixel", 480 * 272, 100, &runDisplayList);
+}
+
+void startKIRK(u32 cmd) {
+    memory::write32(0x1DE0002C, SRC_ADDR); // SRC
+    memory::write32(0x1DE00030, DST_ADDR); // DST
+    memory::write32(0x1DE00010, cmd);      // COMMAND
+    memory::write32(0x1DE0000C, 1);        // PHASE
+
+    finishEvent();
+}
+
+void benchKIRK() {
+    constexpr u32 DATA_SIZE = 0x4000;
+
+    // Command 7 header: mode, key index, data length
+    memory::write32(SRC_ADDR + 0x00, 5);
+    memory::write32(SRC_ADDR + 0x0C, 0);
+    memory::write32(SRC_ADDR + 0x10, DATA_SIZE);
+
+    measure("kirk AES (16 KiB)", "B", DATA_SIZE, 1000, []() {startKIRK(0x07);});
+
+    // Command 11 header: data length
+    memory::write32(SRC_ADDR, DATA_SIZE);
+
+    measure("kirk SHA-1 (16 KiB)", "B", DATA_SIZE, 1000, []() {startKIRK(0x0B);});
+}
+
+void benchDMACplus() {
+    constexpr u32 LENGTH = 0x800; // 16-byte units
+
+    measure("dmacplus::doTransfer (32 KiB)", "B", 16 * LENGTH, 1000, []() {
+        memory::write32(0x1C8001C0, SRC_ADDR); // DMA2SRC
+        memory::write32(0x1C8001C4, DST_ADDR); // DMA2DST
+        memory::write32(0x1C8001C8, 0);        // DMA2TAG
+        memory::write32(0x1C8001CC, LENGTH | (1 << 12) | (1 << 15) | (4 << 18) | (4 << 21) | (1 << 26) | (1 << 27)); // DMA2ATTR
+        memory::write32(0x1C8001D0, 1);        // DMA2STATUS, starts the transfer
+
+        finishEvent();
+    });
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (!config::parseOption(argv[i])) {
+            std::puts("Usage: ChiSP_bench [options]");
+
+            config::printOptions();
+
+            return -1;
+        }
+    }
+
+    // Device logs go to stdout, results go to stderr
+    std::freopen("/dev/null", "w", stdout);
+
+    memory::init(NULL);
+
+    cpu.init(allegrex::Type::Allegrex);
+
+    dmacplus::init();
+    ge::init();
+    kirk::init();
+
+    // Keeps the next event far away, engine slices are only bounded by config::maxSliceCycles
+    scheduler::addEvent(scheduler::registerEvent([](int) {}), 0, (i64)1 << 60);
+
+    benchInterpreter();
+    benchMemory();
+    benchScheduler();
+    benchGE();
+    benchKIRK();
+    benchDMACplus();
+
+    return 0;
+}
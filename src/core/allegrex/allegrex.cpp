@@ -9,8 +9,6 @@
 #include <cstdio>
 #include <cstring>
 
-#include "../memory.hpp"
-
 namespace psp::allegrex {
 
 constexpr u32 BOOT_EXCEPTION_BASE = 0xBFC00000;
@@ -33,25 +31,6 @@ void Allegrex::init(Type type) {
     // Set initial PC
     setPC(BOOT_EXCEPTION_BASE);
 
-    // Install read/write handlers
-    if (type == Type::MediaEngine) {
-        read8  = &memory::meRead8;
-        read16 = &memory::meRead16;
-        read32 = &memory::meRead32;
-
-        write8  = &memory::meWrite8;
-        write16 = &memory::meWrite16;
-        write32 = &memory::meWrite32;
-    } else {
-        read8  = &memory::read8;
-        read16 = &memory::read16;
-        read32 = &memory::read32;
-
-        write8  = &memory::write8;
-        write16 = &memory::write16;
-        write32 = &memory::write32;
-    }
-
     std::printf("[%s] OK\n", typeNames[(int)type]);
 }
 
@@ -62,6 +41,7 @@ void Allegrex::reset() {
     inDelaySlot[0] = inDelaySlot[1] = false;
 
     isHalted = false;
+    isIdle = false;
 
     // Set initial PC
     setPC(BOOT_EXCEPTION_BASE);
@@ -133,6 +113,11 @@ void Allegrex::advancePC() {
     npc += 4;
 }
 
+// Returns true if the next instruction is in a branch delay slot
+bool Allegrex::isDelaySlotPending() {
+    return inDelaySlot[1];
+}
+
 void Allegrex::doBranch(u32 target, bool cond, int linkReg, bool isLikely) {
     if (inDelaySlot[0]) {
         std::printf("%s branch instruction in delay slot\n", typeNames[(int)type]);
@@ -171,6 +156,7 @@ void Allegrex::raiseException(Exception excode) {
     std::printf("[%s] Exception 0x%02X @ 0x%08X\n", typeNames[(int)type], (u32)excode, pc);
 
     isHalted = false;
+    isIdle = false;
 
     cop0.setEXCODE(excode);
 
@@ -9,6 +9,12 @@
 #include "fpu.hpp"
 #include "../../common/types.hpp"
 
+namespace psp::allegrex::jit {
+
+struct Compiler;
+
+}
+
 namespace psp::allegrex {
 
 using cop0::COP0;
@@ -40,6 +46,8 @@ struct Allegrex {
     void advanceDelay();
     void advancePC();
 
+    bool isDelaySlotPending();
+
     void doBranch(u32 target, bool cond, int linkReg, bool isLikely);
 
     void checkInterrupt();
@@ -48,22 +56,20 @@ struct Allegrex {
     void raiseException(Exception excode);
     void exceptionReturn();
 
-    // Read/write handlers
-    u8  (*read8 )(u32);
-    u16 (*read16)(u32);
-    u32 (*read32)(u32);
-
-    void (*write8 )(u32, u8);
-    void (*write16)(u32, u16);
-    void (*write32)(u32, u32);
-
     // Coprocessors
     COP0 cop0;
     FPU  fpu;
 
     bool isHalted;
+    bool isIdle; // Set if the core is spinning in an idle loop, cleared on the next run
+
+    i64 cycles; // Cycles executed in the current slice, in the core's clock
+
+    u32 blockCycles; // Cycles of the running compiled block up to the current COP0 instruction, not in cycles yet
 
 private:
+    friend struct jit::Compiler; // Compiled code accesses the CPU state directly
+
     Type type; // CPU type
 
     u32 regs[34]; // 32 GPRs, LO, HI
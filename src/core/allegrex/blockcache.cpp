@@ -0,0 +1,420 @@
+/*
+ * ChiSP is a PlayStation Portable emulator written in C++.
+ * Copyright (C) 2023  noumidev
+ */
+
+#include "blockcache.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+#include "allegrex.hpp"
+
+#include "../config.hpp"
+#include "../memory.hpp"
+#include "../psp.hpp"
+
+namespace psp::allegrex::blockcache {
+
+using memory::MemoryBase;
+
+constexpr u32 PAGE_SHIFT = 12;
+constexpr u32 PAGE_SIZE  = 1 << PAGE_SHIFT;
+
+constexpr u64 LOOKUP_SIZE = 1 << 16;
+
+constexpr u32 PROFILE_MAGIC = 0x46505343; // "CSPF"
+constexpr u32 PROFILE_VERSION = 1;
+
+constexpr u16 RUNS_COMPILED = 0xFFFF; // Saved run count of compiled blocks
+
+using BlockMap = std::unordered_map<u32, Block>;
+
+// Saved block, only a hint: blocks are always decoded from the current memory contents
+struct Profile {
+    u64 key;
+    u16 instrCount;
+    u16 runCount;
+    u32 reserved;
+};
+
+// Per-core block cache
+struct Cache {
+    BlockMap blocks;
+
+    // Extracted nodes keep invalidated blocks alive until the next lookup
+    std::vector<BlockMap::node_type> retired;
+
+    // Block addresses on each physical page
+    std::unordered_map<u32, std::vector<u32>> pages;
+
+    // Pages invalidated by another thread, dropped by the owning core on its next lookup
+    std::mutex pendingMutex;
+    std::vector<u32> pendingPages;
+    std::atomic<bool> hasPendingPages;
+
+    // Direct-mapped lookup table, indexed by physical address
+    std::array<Block *, LOOKUP_SIZE> lookup;
+
+    // Executions of uncached code, indexed like the lookup table
+    std::array<u16, LOOKUP_SIZE> heat;
+
+    // Content hashes of the physical pages blocks were decoded from, dropped with the page's blocks
+    std::unordered_map<u32, u64> pageHashes;
+
+    // Block profiles by key, loaded on startup and updated when blocks are dropped
+    std::unordered_map<u64, Profile> profiles;
+};
+
+Cache caches[2]; // CPU, ME
+
+u32 getLookupIdx(u32 paddr) {
+    return (paddr >> 2) & (LOOKUP_SIZE - 1);
+}
+
+u32 fetch(Allegrex *allegrex, u32 addr) {
+    if (allegrex->isME()) return memory::meRead32(addr);
+
+    return memory::read32(addr);
+}
+
+// Decodes a basic block starting at addr
+Block buildBlock(Allegrex *allegrex, u32 addr) {
+    Block block;
+
+    block.addr = addr & ((u32)MemoryBase::PAddrSpace - 1);
+    block.code = NULL;
+    block.runCount = 0;
+    block.profileKey = 0;
+
+    while (true) {
+        const auto instr = fetch(allegrex, addr);
+
+        block.instrs.push_back(Instr{interpreter::decode(allegrex, instr), instr});
+
+        addr += 4;
+
+        // Don't cross page boundaries, a trailing delay slot is executed by the next block
+        if (!(addr & (PAGE_SIZE - 1))) break;
+
+        if (interpreter::isBranch(instr)) {
+            const auto delayInstr = fetch(allegrex, addr);
+
+            block.instrs.push_back(Instr{interpreter::decode(allegrex, delayInstr), delayInstr});
+
+            break;
+        }
+    }
+
+    ir::translate(allegrex, &block);
+
+    block.isIdleLoop = interpreter::isIdleLoop(&block);
+    block.isPollLoop = block.isIdleLoop && interpreter::isPollLoop(&block);
+
+    return block;
+}
+
+// FNV-1a over 64-bit words
+u64 hashPage(const u8 *mem) {
+    u64 hash = 0xCBF29CE484222325;
+
+    for (u32 i = 0; i < PAGE_SIZE; i += 8) {
+        u64 word;
+
+        std::memcpy(&word, &mem[i], sizeof(u64));
+
+        hash = (hash ^ word) * 0x100000001B3;
+    }
+
+    return hash;
+}
+
+// Returns the profile key of paddr, 0 if it isn't RAM. Hashed pages are marked as code so writes drop their hash
+u64 getProfileKey(bool isME, Cache &cache, u32 paddr) {
+    const auto page = paddr >> PAGE_SHIFT;
+
+    auto hash = cache.pageHashes.find(page);
+
+    if (hash == cache.pageHashes.end()) {
+        const auto mem = memory::getMappedPointer(isME, page << PAGE_SHIFT);
+
+        if (mem == NULL) return 0;
+
+        hash = cache.pageHashes.emplace(page, hashPage(mem)).first;
+
+        memory::markCode(isME, paddr);
+    }
+
+    // Offsets are word-aligned, the low bits of the key are never all clear
+    return hash->second ^ ((u64)(paddr & (PAGE_SIZE - 1)) << 48) ^ 1;
+}
+
+// Keeps the highest tier a block has reached
+void updateProfile(Cache &cache, const Block &block) {
+    if (block.profileKey == 0) return;
+
+    const u16 runCount = (block.code != NULL) ? RUNS_COMPILED : std::min(block.runCount, (u32)RUNS_COMPILED - 1);
+
+    auto &profile = cache.profiles[block.profileKey];
+
+    profile.key = block.profileKey;
+    profile.instrCount = block.instrs.size();
+    profile.runCount = std::max(profile.runCount, runCount);
+}
+
+// Moves a block to the retired list
+void retire(Cache &cache, u32 paddr) {
+    auto node = cache.blocks.extract(paddr);
+
+    if (node.empty()) return;
+
+    updateProfile(cache, node.mapped());
+
+    auto &entry = cache.lookup[getLookupIdx(paddr)];
+
+    if (entry == &node.mapped()) entry = NULL;
+
+    cache.retired.push_back(std::move(node));
+}
+
+// Retires all blocks on a physical page
+void dropPage(Cache &cache, u32 page) {
+    cache.pageHashes.erase(page);
+
+    const auto blocks = cache.pages.find(page);
+
+    if (blocks == cache.pages.end()) return;
+
+    for (const auto paddr : blocks->second) retire(cache, paddr);
+
+    cache.pages.erase(blocks);
+}
+
+void invalidatePendingPages(bool isME) {
+    auto &cache = caches[isME];
+
+    std::lock_guard lock(cache.pendingMutex);
+
+    for (const auto page : cache.pendingPages) dropPage(cache, page);
+
+    cache.pendingPages.clear();
+    cache.hasPendingPages.store(false, std::memory_order_relaxed);
+}
+
+// Frees retired blocks and drops pages invalidated by the other core
+void beginLookup(Allegrex *allegrex, Cache &cache) {
+    // No block is executing at this point, retired blocks can be freed
+    if (!cache.retired.empty()) {
+        cache.retired.clear();
+    }
+
+    if (cache.hasPendingPages.load(std::memory_order_acquire)) {
+        invalidatePendingPages(allegrex->isME());
+    }
+}
+
+// Returns the cached block at paddr, NULL if there is none
+Block *findBlock(Cache &cache, u32 paddr) {
+    auto &entry = cache.lookup[getLookupIdx(paddr)];
+
+    if ((entry != NULL) && (entry->addr == paddr)) {
+        return entry;
+    }
+
+    const auto block = cache.blocks.find(paddr);
+
+    if (block == cache.blocks.end()) return NULL;
+
+    entry = &block->second;
+
+    return entry;
+}
+
+// Decodes a new block
+Block *addBlock(Allegrex *allegrex, Cache &cache, u32 addr) {
+    const auto paddr = addr & ((u32)MemoryBase::PAddrSpace - 1);
+
+    const auto block = cache.blocks.emplace(paddr, buildBlock(allegrex, addr)).first;
+
+    if (config::blockCachePath != NULL) {
+        auto &newBlock = block->second;
+
+        newBlock.profileKey = getProfileKey(allegrex->isME(), cache, paddr);
+
+        // Start in the tier the block reached in earlier runs
+        const auto profile = cache.profiles.find(newBlock.profileKey);
+
+        if ((profile != cache.profiles.end()) && (profile->second.instrCount == newBlock.instrs.size())) {
+            newBlock.runCount = profile->second.runCount;
+        }
+    }
+
+    cache.pages[paddr >> PAGE_SHIFT].push_back(paddr);
+
+    memory::markCode(allegrex->isME(), paddr);
+
+    cache.lookup[getLookupIdx(paddr)] = &block->second;
+
+    return &block->second;
+}
+
+// Returns the block at addr, decodes a new block if necessary
+Block *getBlock(Allegrex *allegrex, u32 addr) {
+    auto &cache = caches[allegrex->isME()];
+
+    beginLookup(allegrex, cache);
+
+    if (const auto block = findBlock(cache, addr & ((u32)MemoryBase::PAddrSpace - 1))) return block;
+
+    return addBlock(allegrex, cache, addr);
+}
+
+Block *getWarmBlock(Allegrex *allegrex, u32 addr, u32 threshold) {
+    auto &cache = caches[allegrex->isME()];
+
+    beginLookup(allegrex, cache);
+
+    const auto paddr = addr & ((u32)MemoryBase::PAddrSpace - 1);
+
+    if (const auto block = findBlock(cache, paddr)) return block;
+
+    // Code has to warm up again if its block is invalidated
+    auto &heat = cache.heat[getLookupIdx(paddr)];
+
+    if (heat < 0xFFFF) heat++;
+
+    // Code that has been cached in earlier runs skips the cold tier
+    if ((heat < threshold) && (cache.profiles.empty() || !cache.profiles.contains(getProfileKey(allegrex->isME(), cache, paddr)))) {
+        return NULL;
+    }
+
+    heat = 0;
+
+    return addBlock(allegrex, cache, addr);
+}
+
+// Drops all blocks, the currently executing block stays valid until the next lookup
+void invalidateAll(Allegrex *allegrex) {
+    auto &cache = caches[allegrex->isME()];
+
+    while (!cache.blocks.empty()) {
+        updateProfile(cache, cache.blocks.begin()->second);
+
+        cache.retired.push_back(cache.blocks.extract(cache.blocks.begin()));
+    }
+
+    cache.pages.clear();
+    cache.pageHashes.clear();
+
+    cache.lookup.fill(NULL);
+}
+
+void invalidatePage(bool isME, u32 addr) {
+    auto &cache = caches[isME];
+
+    const auto page = (addr & ((u32)MemoryBase::PAddrSpace - 1)) >> PAGE_SHIFT;
+
+    // The other core is running on another thread, let it drop the page itself
+    if (!psp::ownsCore(isME)) {
+        std::lock_guard lock(cache.pendingMutex);
+
+        cache.pendingPages.push_back(page);
+        cache.hasPendingPages.store(true, std::memory_order_release);
+
+        return;
+    }
+
+    dropPage(cache, page);
+}
+
+void invalidateRange(Allegrex *allegrex, u32 addr, u32 size) {
+    auto &cache = caches[allegrex->isME()];
+
+    const auto paddr = addr & ((u32)MemoryBase::PAddrSpace - 1);
+
+    const auto page = cache.pages.find(paddr >> PAGE_SHIFT);
+
+    if (page == cache.pages.end()) return;
+
+    // Blocks never cross pages, only the page containing addr has to be searched
+    std::erase_if(page->second, [&](u32 blockAddr) {
+        const auto block = cache.blocks.find(blockAddr);
+
+        if ((block == cache.blocks.end()) || (blockAddr >= (paddr + size)) || ((blockAddr + 4 * block->second.instrs.size()) <= paddr)) return false;
+
+        retire(cache, blockAddr);
+
+        return true;
+    });
+
+    // The range may have been rewritten, the page is hashed again for new blocks
+    cache.pageHashes.erase(paddr >> PAGE_SHIFT);
+}
+
+void loadProfiles(const char *path) {
+    const auto file = std::fopen(path, "rb");
+
+    // The file is created on exit
+    if (file == NULL) return;
+
+    u32 header[2];
+
+    if ((std::fread(header, sizeof(u32), 2, file) != 2) || (header[0] != PROFILE_MAGIC) || (header[1] != PROFILE_VERSION)) {
+        std::printf("[Blocks  ] Ignoring block profiles in \"%s\", unknown format\n", path);
+
+        std::fclose(file);
+
+        return;
+    }
+
+    for (auto &cache : caches) {
+        u32 count;
+
+        if (std::fread(&count, sizeof(u32), 1, file) != 1) break;
+
+        for (u32 i = 0; i < count; i++) {
+            Profile profile;
+
+            if (std::fread(&profile, sizeof(Profile), 1, file) != 1) break;
+
+            cache.profiles[profile.key] = profile;
+        }
+    }
+
+    std::fclose(file);
+
+    std::printf("[Blocks  ] Loaded %zu CPU and %zu ME block profiles\n", caches[0].profiles.size(), caches[1].profiles.size());
+}
+
+void saveProfiles(const char *path) {
+    const auto file = std::fopen(path, "wb");
+
+    if (file == NULL) {
+        std::printf("[Blocks  ] Unable to write block profiles to \"%s\"\n", path);
+
+        return;
+    }
+
+    const u32 header[2] = {PROFILE_MAGIC, PROFILE_VERSION};
+
+    std::fwrite(header, sizeof(u32), 2, file);
+
+    for (auto &cache : caches) {
+        for (const auto &[paddr, block] : cache.blocks) updateProfile(cache, block);
+
+        const u32 count = cache.profiles.size();
+
+        std::fwrite(&count, sizeof(u32), 1, file);
+
+        for (const auto &[key, profile] : cache.profiles) std::fwrite(&profile, sizeof(Profile), 1, file);
+    }
+
+    std::fclose(file);
+}
+
+}
@@ -0,0 +1,66 @@
+/*
+ * ChiSP is a PlayStation Portable emulator written in C++.
+ * Copyright (C) 2023  noumidev
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "interpreter.hpp"
+#include "ir.hpp"
+#include "../../common/types.hpp"
+
+namespace psp::allegrex {
+
+struct Allegrex;
+
+}
+
+namespace psp::allegrex::blockcache {
+
+// Compiled block, returns the number of executed instructions
+using CodeFunc = i64 (*)(Allegrex *);
+
+// Pre-decoded instruction
+struct Instr {
+    interpreter::InstrFunc func;
+    u32 instr;
+};
+
+// Guest basic block, ends after a branch delay slot or at a page boundary
+struct Block {
+    u32 addr; // Physical address of the first instruction
+
+    std::vector<Instr> instrs;
+    std::vector<ir::Op> ops; // Optimized form of instrs
+
+    CodeFunc code; // Host code, NULL if the block hasn't been compiled yet
+    u32 codeAddr;  // Virtual address the host code was compiled for
+
+    u32 runCount; // Executions in the tiered engine, counts up to the JIT threshold
+
+    u64 profileKey; // Page content hash and page offset, 0 if the block has no profile
+
+    bool isIdleLoop; // Set if the block is a side effect-free loop
+    bool isPollLoop; // Set if the block is an idle loop with a single load, i.e. it polls one register
+};
+
+Block *getBlock(Allegrex *allegrex, u32 addr);
+
+// Returns the block at addr if it is cached or addr has run threshold times without one, NULL for cold code
+Block *getWarmBlock(Allegrex *allegrex, u32 addr, u32 threshold);
+
+void invalidateAll(Allegrex *allegrex);
+
+// Block profiles keep the tier every block reached across runs, they are matched by the content of the block's page
+void loadProfiles(const char *path);
+void saveProfiles(const char *path);
+
+// Drops all blocks of a core on the physical page at addr
+void invalidatePage(bool isME, u32 addr);
+
+// Drops the blocks of a core that overlap addr,(addr + size), the range must not cross pages
+void invalidateRange(Allegrex *allegrex, u32 addr, u32 size);
+
+}
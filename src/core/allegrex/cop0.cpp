@@ -9,11 +9,25 @@
 #include <cstdio>
 
 #include "allegrex.hpp"
+#include "../psp.hpp"
+#include "../scheduler.hpp"
 
 namespace psp::allegrex::cop0 {
 
 constexpr u32 CONFIG = 0x480;
 
+// Count increments every CPU cycle, the ME runs at half the CPU clock
+constexpr int COUNT_SHIFT[] = {0, 1};
+
+COP0 *cop0s[2]; // CPU, ME
+
+// Compare interrupt event, shared by both cores
+u64 getCompareEvent() {
+    static const auto id = scheduler::registerEvent([](int cpuID) {cop0s[cpuID]->compareInterrupt();});
+
+    return id;
+}
+
 const char *cop0Name[] = {
     "COP0:CPU", "COP0:ME ",
 };
@@ -57,8 +71,14 @@ void COP0::init(Allegrex *allegrex, int cpuID) {
     this->allegrex = allegrex;
     this->cpuID = cpuID;
 
+    cop0s[cpuID] = this;
+
     compare = -1;
 
+    compareEvent = scheduler::NO_EVENT;
+
+    setCount(0);
+
     std::printf("[%s] OK\n", cop0Name[cpuID]);
 }
 
@@ -75,7 +95,7 @@ u32 COP0::getStatus(int idx) {
         case StatusReg::BadVaddr:
             return badvaddr;
         case StatusReg::Count:
-            return count;
+            return getCount();
         case StatusReg::Compare:
             return compare;
         case StatusReg::Status:
@@ -111,13 +131,15 @@ void COP0::setStatus(int idx, u32 data) {
     switch ((StatusReg)idx) {
         case StatusReg::Count:
             std::printf("COUNT: 0x%08X\n", data);
-            count = oldCount = data;
+            setCount(data);
             break;
         case StatusReg::Compare:
             std::printf("COMPARE: 0x%08X\n", data);
             compare = data;
 
             setCountPending(false);
+
+            scheduleCompare();
             break;
         case StatusReg::Status:
             status = data;
@@ -148,18 +170,44 @@ void COP0::setStatus(int idx, u32 data) {
     }
 }
 
-void COP0::runCount(i64 runCycles) {
-    oldCount = count;
+// Count is derived from the scheduler time at the current instruction
+u32 COP0::getCount() {
+    return baseCount + (u32)((psp::getCoreTimestamp(cpuID) - baseTimestamp) >> COUNT_SHIFT[cpuID]);
+}
 
-    count += runCycles;
+void COP0::setCount(u32 data) {
+    baseCount = data;
+    baseTimestamp = psp::getCoreTimestamp(cpuID);
 
-    if ((oldCount < compare) && (count >= compare)) {
-        std::printf("COUNT >= COMPARE (0x%08X 0x%08X)\n", count, compare);
+    scheduleCompare();
+}
 
-        setCountPending(true);
+// Schedules the compare interrupt at the cycle where Count becomes equal to Compare
+void COP0::scheduleCompare() {
+    scheduler::cancelEvent(compareEvent);
 
-        allegrex->checkInterrupt();
-    }
+    const auto now = psp::getCoreTimestamp(cpuID);
+    const auto elapsed = (now - baseTimestamp) >> COUNT_SHIFT[cpuID];
+
+    // Count has to wrap around if it's already equal to Compare
+    i64 ticks = (u32)(compare - (baseCount + (u32)elapsed));
+
+    if (ticks == 0) ticks = (i64)1 << 32;
+
+    // Events are scheduled relative to the scheduler time, which may be behind the core
+    compareEvent = scheduler::addEvent(getCompareEvent(), cpuID, baseTimestamp + ((elapsed + ticks) << COUNT_SHIFT[cpuID]) - scheduler::getTimestamp());
+}
+
+void COP0::compareInterrupt() {
+    std::printf("COUNT >= COMPARE (0x%08X 0x%08X)\n", getCount(), compare);
+
+    compareEvent = scheduler::NO_EVENT;
+
+    setCountPending(true);
+
+    allegrex->checkInterrupt();
+
+    scheduleCompare();
 }
 
 bool COP0::isCOPUsable(int copN) {
@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include "../scheduler.hpp"
 #include "../../common/types.hpp"
 
 namespace psp::allegrex {
@@ -29,7 +30,10 @@ struct COP0 {
     u32  getStatus(int idx);
     void setStatus(int idx, u32 data);
 
-    void runCount(i64 runCycles);
+    u32  getCount();
+    void setCount(u32 data);
+
+    void compareInterrupt();
 
     bool isCOPUsable(int copN);
 
@@ -56,11 +60,15 @@ struct COP0 {
 
     u32 exceptionReturn();
 private:
+    void scheduleCompare();
+
     Allegrex *allegrex;
 
     // Status
     u32 cpuID;
-    u32 count, oldCount, compare;
+    u32 baseCount, compare; // Count at baseTimestamp
+    i64 baseTimestamp;
+    scheduler::EventHandle compareEvent;
     u32 status, cause;
     u32 badvaddr;
     u32 epc, errorEPC;
@@ -5,32 +5,41 @@
 
 #include "interpreter.hpp"
 
+#include <array>
 #include <bit>
 #include <cassert>
 #include <cstdio>
 #include <cstring>
 
 #include "allegrex.hpp"
+#include "blockcache.hpp"
+#include "lockstep.hpp"
+#include "opcodes.hpp"
 #include "vfpu.hpp"
 
+#include "../config.hpp"
 #include "../memory.hpp"
+#include "../scheduler.hpp"
 
 namespace psp::allegrex::interpreter {
 
+// Labels as values are a GNU extension
+#if defined(__GNUC__) || defined(__clang__)
+#define INTERPRETER_THREADED
+#endif
+
 constexpr auto ENABLE_DISASM = false;
 constexpr auto ENABLE_VFPU_DISASM = true;
 
-enum Reg {
-    R0 =  0, AT =  1, V0 =  2, V1 =  3,
-    A0 =  4, A1 =  5, A2 =  6, A3 =  7,
-    T0 =  8, T1 =  9, T2 = 10, T3 = 11,
-    T4 = 12, T5 = 13, T6 = 14, T7 = 15,
-    S0 = 16, S1 = 17, S2 = 18, S3 = 19,
-    S4 = 20, S5 = 21, S6 = 22, S7 = 23,
-    T8 = 24, T9 = 25, K0 = 26, K1 = 27,
-    GP = 28, SP = 29, S8 = 30, RA = 31,
-    LO = 32, HI = 33,
-};
+constexpr u32 ICACHE_LINE_SIZE = 64;
+
+constexpr u64 MAX_IDLE_LOOP_SIZE = 16; // In instructions
+
+constexpr u32 BLOCK_PAGE_SIZE = 1 << 12; // Blocks end at page boundaries, see blockcache.cpp
+
+// The ME runs at half the CPU clock
+template<Type type>
+constexpr int CLOCK_SHIFT = (type == Type::MediaEngine) ? 1 : 0;
 
 const char *regNames[34] = {
     "R0", "AT", "V0", "V1", "A0", "A1", "A2", "A3",
@@ -40,180 +49,65 @@ const char *regNames[34] = {
     "LO", "HI",
 };
 
-enum class Opcode {
-    SPECIAL = 0x00,
-    REGIMM  = 0x01,
-    J = 0x02,
-    JAL  = 0x03,
-    BEQ  = 0x04,
-    BNE  = 0x05,
-    BLEZ  = 0x06,
-    BGTZ  = 0x07,
-    ADDI  = 0x08,
-    ADDIU = 0x09,
-    SLTI  = 0x0A,
-    SLTIU = 0x0B,
-    ANDI = 0x0C,
-    ORI  = 0x0D,
-    XORI = 0x0E,
-    LUI  = 0x0F,
-    COP0 = 0x10,
-    COP1 = 0x11,
-    COP2 = 0x12,
-    BEQL = 0x14,
-    BNEL = 0x15,
-    BLEZL = 0x16,
-    BGTZL = 0x17,
-    SPECIAL2 = 0x1C,
-    SPECIAL3 = 0x1F,
-    LB  = 0x20,
-    LH  = 0x21,
-    LWL = 0x22,
-    LW  = 0x23,
-    LBU = 0x24,
-    LHU = 0x25,
-    LWR = 0x26,
-    SB  = 0x28,
-    SH  = 0x29,
-    SWL = 0x2A,
-    SW  = 0x2B,
-    SWR = 0x2E,
-    CACHE = 0x2F,
-    LWC1  = 0x31,
-    SWC1  = 0x39,
-    SQC2  = 0x3E,
-};
-
-enum class SPECIAL {
-    SLL  = 0x00,
-    SRL  = 0x02,
-    SRA  = 0x03,
-    SLLV = 0x04,
-    SRLV = 0x06,
-    SRAV = 0x07,
-    JR = 0x08,
-    JALR = 0x09,
-    MOVZ = 0x0A,
-    MOVN = 0x0B,
-    SYSCALL = 0x0C,
-    SYNC = 0x0F,
-    MFHI = 0x10,
-    MTHI = 0x11,
-    MFLO = 0x12,
-    MTLO = 0x13,
-    CLZ = 0x16,
-    MULT  = 0x18,
-    MULTU = 0x19,
-    DIV  = 0x1A,
-    DIVU = 0x1B,
-    ADD  = 0x20,
-    ADDU = 0x21,
-    SUB  = 0x22,
-    SUBU = 0x23,
-    AND = 0x24,
-    OR  = 0x25,
-    XOR = 0x26,
-    NOR = 0x27,
-    SLT  = 0x2A,
-    SLTU = 0x2B,
-    MAX = 0x2C,
-    MIN = 0x2D,
-};
-
-enum class SPECIAL2 {
-    HALT = 0x00,
-    MFIC = 0x24,
-    MTIC = 0x26,
-};
-
-enum class SPECIAL3 {
-    EXT = 0x00,
-    INS = 0x04,
-    BSHFL = 0x20,
-};
-
-enum class BSHFL {
-    WSBH = 0x02,
-    WSBW = 0x03,
-    SEB = 0x10,
-    BITREV = 0x14,
-    SEH = 0x18,
-};
-
-enum class REGIMM {
-    BLTZ  = 0x00,
-    BGEZ  = 0x01,
-    BLTZL = 0x02,
-    BGEZL = 0x03,
-    BLTZAL = 0x10,
-    BGEZAL = 0x11,
-};
-
-enum class COPOpcode {
-    MFC  = 0x00,
-    CFC  = 0x02,
-    MFHC = 0x03,
-    MTC  = 0x04,
-    CTC  = 0x06,
-    BC = 0x08,
-    CO = 0x10,
-    W = 0x14,
-};
-
-enum class COP0Opcode {
-    ERET = 0x18,
-};
+thread_local u32 cpc; // Current program counter, per thread so that the ME can run on its own
 
-enum class BC {
-    BCF  = 0,
-    BCT  = 1,
-    BCFL = 2,
-    BCTL = 3,
-};
-
-u32 cpc; // Current program counter
-
-// Returns primary opcode
-u32 getOpcode(u32 instr) {
-    return instr >> 26;
-}
-
-// Returns secondary opcode
-u32 getFunct(u32 instr) {
-    return instr & 0x3F;
-}
-
-// Returns shift amount
-u32 getShamt(u32 instr) {
-    return (instr >> 6) & 0x1F;
+// Memory accessors, resolved at compile time
+template<Type type>
+u8 read8(u32 addr) {
+    if constexpr (type == Type::MediaEngine) {
+        return memory::meRead8(addr);
+    } else {
+        return memory::read8(addr);
+    }
 }
 
-// Returns 16-bit immediate
-u32 getImm(u32 instr) {
-    return instr & 0xFFFF;
+template<Type type>
+u16 read16(u32 addr) {
+    if constexpr (type == Type::MediaEngine) {
+        return memory::meRead16(addr);
+    } else {
+        return memory::read16(addr);
+    }
 }
 
-// Returns branch offset
-u32 getOffset(u32 instr) {
-    return instr & 0x3FFFFFF;
+template<Type type>
+u32 read32(u32 addr) {
+    if constexpr (type == Type::MediaEngine) {
+        return memory::meRead32(addr);
+    } else {
+        return memory::read32(addr);
+    }
 }
 
-// Returns Rd
-u32 getRd(u32 instr) {
-    return (instr >> 11) & 0x1F;
+template<Type type>
+void write8(u32 addr, u8 data) {
+    if constexpr (type == Type::MediaEngine) {
+        return memory::meWrite8(addr, data);
+    } else {
+        return memory::write8(addr, data);
+    }
 }
 
-// Returns Rs
-u32 getRs(u32 instr) {
-    return (instr >> 21) & 0x1F;
+template<Type type>
+void write16(u32 addr, u16 data) {
+    if constexpr (type == Type::MediaEngine) {
+        return memory::meWrite16(addr, data);
+    } else {
+        return memory::write16(addr, data);
+    }
 }
 
-// Returns Rt
-u32 getRt(u32 instr) {
-    return (instr >> 16) & 0x1F;
+template<Type type>
+void write32(u32 addr, u32 data) {
+    if constexpr (type == Type::MediaEngine) {
+        return memory::meWrite32(addr, data);
+    } else {
+        return memory::write32(addr, data);
+    }
 }
 
 // ADD
+template<Type type>
 void iADD(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -235,6 +129,7 @@ void iADD(Allegrex *allegrex, u32 instr) {
 }
 
 // ADD Immediate
+template<Type type>
 void iADDI(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -256,6 +151,7 @@ void iADDI(Allegrex *allegrex, u32 instr) {
 }
 
 // ADD Immediate Unsigned
+template<Type type>
 void iADDIU(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -269,6 +165,7 @@ void iADDIU(Allegrex *allegrex, u32 instr) {
 }
 
 // ADD Unsigned
+template<Type type>
 void iADDU(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -282,6 +179,7 @@ void iADDU(Allegrex *allegrex, u32 instr) {
 }
 
 // AND
+template<Type type>
 void iAND(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -295,6 +193,7 @@ void iAND(Allegrex *allegrex, u32 instr) {
 }
 
 // AND Immediate
+template<Type type>
 void iANDI(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -308,7 +207,8 @@ void iANDI(Allegrex *allegrex, u32 instr) {
 }
 
 // Branch on Coprocessor False
-void iBCF(Allegrex *allegrex, int copN, u32 instr) {
+template<Type type, int copN>
+void iBCF(Allegrex *allegrex, u32 instr) {
     const auto offset = (i32)(i16)getImm(instr) << 2;
     const auto target = allegrex->getPC() + offset;
 
@@ -333,7 +233,8 @@ void iBCF(Allegrex *allegrex, int copN, u32 instr) {
 }
 
 // Branch on Coprocessor False Likely
-void iBCFL(Allegrex *allegrex, int copN, u32 instr) {
+template<Type type, int copN>
+void iBCFL(Allegrex *allegrex, u32 instr) {
     const auto offset = (i32)(i16)getImm(instr) << 2;
     const auto target = allegrex->getPC() + offset;
 
@@ -358,7 +259,8 @@ void iBCFL(Allegrex *allegrex, int copN, u32 instr) {
 }
 
 // Branch on Coprocessor True
-void iBCT(Allegrex *allegrex, int copN, u32 instr) {
+template<Type type, int copN>
+void iBCT(Allegrex *allegrex, u32 instr) {
     const auto offset = (i32)(i16)getImm(instr) << 2;
     const auto target = allegrex->getPC() + offset;
 
@@ -383,7 +285,8 @@ void iBCT(Allegrex *allegrex, int copN, u32 instr) {
 }
 
 // Branch on Coprocessor True Likely
-void iBCTL(Allegrex *allegrex, int copN, u32 instr) {
+template<Type type, int copN>
+void iBCTL(Allegrex *allegrex, u32 instr) {
     const auto offset = (i32)(i16)getImm(instr) << 2;
     const auto target = allegrex->getPC() + offset;
 
@@ -408,6 +311,7 @@ void iBCTL(Allegrex *allegrex, int copN, u32 instr) {
 }
 
 // Branch if EQual
+template<Type type>
 void iBEQ(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -426,6 +330,7 @@ void iBEQ(Allegrex *allegrex, u32 instr) {
 }
 
 // Branch if EQual Likely
+template<Type type>
 void iBEQL(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -444,6 +349,7 @@ void iBEQL(Allegrex *allegrex, u32 instr) {
 }
 
 // Branch if Greater than or Equal Zero
+template<Type type>
 void iBGEZ(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto offset = (i32)(i16)getImm(instr) << 2;
@@ -460,6 +366,7 @@ void iBGEZ(Allegrex *allegrex, u32 instr) {
 }
 
 // Branch if Greater than or Equal Zero And Link
+template<Type type>
 void iBGEZAL(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto offset = (i32)(i16)getImm(instr) << 2;
@@ -476,6 +383,7 @@ void iBGEZAL(Allegrex *allegrex, u32 instr) {
 }
 
 // Branch if Greater than or Equal Zero Likely
+template<Type type>
 void iBGEZL(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto offset = (i32)(i16)getImm(instr) << 2;
@@ -492,6 +400,7 @@ void iBGEZL(Allegrex *allegrex, u32 instr) {
 }
 
 // Branch if Greater Than Zero
+template<Type type>
 void iBGTZ(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto offset = (i32)(i16)getImm(instr) << 2;
@@ -508,6 +417,7 @@ void iBGTZ(Allegrex *allegrex, u32 instr) {
 }
 
 // Branch if Greater Than Zero Likely
+template<Type type>
 void iBGTZL(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto offset = (i32)(i16)getImm(instr) << 2;
@@ -524,6 +434,7 @@ void iBGTZL(Allegrex *allegrex, u32 instr) {
 }
 
 // BIT REVerse
+template<Type type>
 void iBITREV(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rt = getRt(instr);
@@ -543,6 +454,7 @@ void iBITREV(Allegrex *allegrex, u32 instr) {
 }
 
 // Branch if Less than or Equal Zero
+template<Type type>
 void iBLEZ(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto offset = (i32)(i16)getImm(instr) << 2;
@@ -559,6 +471,7 @@ void iBLEZ(Allegrex *allegrex, u32 instr) {
 }
 
 // Branch if Less than or Equal Zero Likely
+template<Type type>
 void iBLEZL(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto offset = (i32)(i16)getImm(instr) << 2;
@@ -575,6 +488,7 @@ void iBLEZL(Allegrex *allegrex, u32 instr) {
 }
 
 // Branch if Less Than Zero
+template<Type type>
 void iBLTZ(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto offset = (i32)(i16)getImm(instr) << 2;
@@ -591,6 +505,7 @@ void iBLTZ(Allegrex *allegrex, u32 instr) {
 }
 
 // Branch if Less Than Zero And Link
+template<Type type>
 void iBLTZAL(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto offset = (i32)(i16)getImm(instr) << 2;
@@ -607,6 +522,7 @@ void iBLTZAL(Allegrex *allegrex, u32 instr) {
 }
 
 // Branch if Less Than Zero Likely
+template<Type type>
 void iBLTZL(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto offset = (i32)(i16)getImm(instr) << 2;
@@ -623,6 +539,7 @@ void iBLTZL(Allegrex *allegrex, u32 instr) {
 }
 
 // Branch if Not Equal
+template<Type type>
 void iBNE(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -641,6 +558,7 @@ void iBNE(Allegrex *allegrex, u32 instr) {
 }
 
 // Branch if Not Equal Likely
+template<Type type>
 void iBNEL(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -659,6 +577,7 @@ void iBNEL(Allegrex *allegrex, u32 instr) {
 }
 
 // CACHE
+template<Type type>
 void iCACHE(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -667,10 +586,24 @@ void iCACHE(Allegrex *allegrex, u32 instr) {
     if (ENABLE_DISASM) {
         std::printf("[%s] [0x%08X] CACHE 0x%X, 0x%X(%s)\n", allegrex->getTypeName(), cpc, rt, imm, regNames[rs]);
     }
+
+    // Only instruction cache invalidation is relevant, decoded blocks stand in for the I-cache
+    switch ((CACHE)rt) {
+        case CACHE::ICACHE_INDEX_INVALIDATE:
+            // Index ops are used in loops that flush the whole cache
+            blockcache::invalidateAll(allegrex);
+            break;
+        case CACHE::ICACHE_HIT_INVALIDATE:
+            blockcache::invalidateRange(allegrex, (allegrex->get(rs) + imm) & ~(ICACHE_LINE_SIZE - 1), ICACHE_LINE_SIZE);
+            break;
+        default:
+            break;
+    }
 }
 
 // move Coprocessor From Control
-void iCFC(Allegrex *allegrex, int copN, u32 instr) {
+template<Type type, int copN>
+void iCFC(Allegrex *allegrex, u32 instr) {
     assert((copN >= 0) && (copN < 4));
 
     const auto rd = getRd(instr);
@@ -701,6 +634,7 @@ void iCFC(Allegrex *allegrex, int copN, u32 instr) {
 }
 
 /* Count Leading Zeroes */
+template<Type type>
 void iCLZ(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -719,7 +653,8 @@ void iCLZ(Allegrex *allegrex, u32 instr) {
 }
 
 // move to ConTrol Coprocessor
-void iCTC(Allegrex *allegrex, int copN, u32 instr) {
+template<Type type, int copN>
+void iCTC(Allegrex *allegrex, u32 instr) {
     assert((copN >= 0) && (copN < 4));
 
     const auto rd = getRd(instr);
@@ -748,6 +683,7 @@ void iCTC(Allegrex *allegrex, int copN, u32 instr) {
 }
 
 /* DIVide */
+template<Type type>
 void iDIV(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -766,6 +702,7 @@ void iDIV(Allegrex *allegrex, u32 instr) {
 }
 
 /* DIVide Unsigned */
+template<Type type>
 void iDIVU(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -787,6 +724,7 @@ void iDIVU(Allegrex *allegrex, u32 instr) {
 }
 
 // Exception RETurn
+template<Type type>
 void iERET(Allegrex *allegrex, u32 instr) {
     (void)instr;
 
@@ -800,6 +738,7 @@ void iERET(Allegrex *allegrex, u32 instr) {
 }
 
 // Extract
+template<Type type>
 void iEXT(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -818,7 +757,24 @@ void iEXT(Allegrex *allegrex, u32 instr) {
     }
 }
 
+// FPU Single instructions
+template<Type type>
+void iFPUSingle(Allegrex *allegrex, u32 instr) {
+    assert(allegrex->cop0.isCOPUsable(1));
+
+    allegrex->fpu.doSingle(instr);
+}
+
+// FPU Word instructions
+template<Type type>
+void iFPUWord(Allegrex *allegrex, u32 instr) {
+    assert(allegrex->cop0.isCOPUsable(1));
+
+    allegrex->fpu.doWord(instr);
+}
+
 // HALT
+template<Type type>
 void iHALT(Allegrex *allegrex, u32 instr) {
     (void)instr;
 
@@ -830,6 +786,7 @@ void iHALT(Allegrex *allegrex, u32 instr) {
 }
 
 /* INSert */
+template<Type type>
 void iINS(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -847,7 +804,16 @@ void iINS(Allegrex *allegrex, u32 instr) {
     }
 }
 
+// Invalid or unimplemented instruction
+template<Type type>
+void iInvalid(Allegrex *allegrex, u32 instr) {
+    std::printf("Unhandled %s instruction 0x%02X (0x%08X) @ 0x%08X\n", allegrex->getTypeName(), getOpcode(instr), instr, cpc);
+
+    exit(0);
+}
+
 // Jump
+template<Type type>
 void iJ(Allegrex *allegrex, u32 instr) {
     const auto target = (allegrex->getPC() & 0xF0000000) | (getOffset(instr) << 2);
 
@@ -859,6 +825,7 @@ void iJ(Allegrex *allegrex, u32 instr) {
 }
 
 // Jump And Link
+template<Type type>
 void iJAL(Allegrex *allegrex, u32 instr) {
     const auto target = (allegrex->getPC() & 0xF0000000) | (getOffset(instr) << 2);
 
@@ -870,6 +837,7 @@ void iJAL(Allegrex *allegrex, u32 instr) {
 }
 
 // Jump Register
+template<Type type>
 void iJR(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
 
@@ -883,6 +851,7 @@ void iJR(Allegrex *allegrex, u32 instr) {
 }
 
 // Jump And Link Register
+template<Type type>
 void iJALR(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -897,6 +866,7 @@ void iJALR(Allegrex *allegrex, u32 instr) {
 }
 
 // Load Byte
+template<Type type>
 void iLB(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -908,10 +878,11 @@ void iLB(Allegrex *allegrex, u32 instr) {
         std::printf("[%s] [0x%08X] LB %s, 0x%X(%s); %s = [0x%08X]\n", allegrex->getTypeName(), cpc, regNames[rt], imm, regNames[rs], regNames[rt], addr);
     }
 
-    allegrex->set(rt, (i8)allegrex->read8(addr));
+    allegrex->set(rt, (i8)read8<type>(addr));
 }
 
 // Load Byte Unsigned
+template<Type type>
 void iLBU(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -923,10 +894,11 @@ void iLBU(Allegrex *allegrex, u32 instr) {
         std::printf("[%s] [0x%08X] LBU %s, 0x%X(%s); %s = [0x%08X]\n", allegrex->getTypeName(), cpc, regNames[rt], imm, regNames[rs], regNames[rt], addr);
     }
 
-    allegrex->set(rt, allegrex->read8(addr));
+    allegrex->set(rt, read8<type>(addr));
 }
 
 // Load Halfword
+template<Type type>
 void iLH(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -944,10 +916,11 @@ void iLH(Allegrex *allegrex, u32 instr) {
         exit(0);
     }
 
-    allegrex->set(rt, (i16)allegrex->read16(addr));
+    allegrex->set(rt, (i16)read16<type>(addr));
 }
 
 // Load Halfword Unsigned
+template<Type type>
 void iLHU(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -965,10 +938,11 @@ void iLHU(Allegrex *allegrex, u32 instr) {
         exit(0);
     }
 
-    allegrex->set(rt, allegrex->read16(addr));
+    allegrex->set(rt, read16<type>(addr));
 }
 
 // Load Upper Immediate
+template<Type type>
 void iLUI(Allegrex *allegrex, u32 instr) {
     const auto rt  = getRt(instr);
     const auto imm = getImm(instr);
@@ -981,6 +955,7 @@ void iLUI(Allegrex *allegrex, u32 instr) {
 }
 
 // Load Word
+template<Type type>
 void iLW(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -998,11 +973,12 @@ void iLW(Allegrex *allegrex, u32 instr) {
         exit(0);
     }
 
-    allegrex->set(rt, allegrex->read32(addr));
+    allegrex->set(rt, read32<type>(addr));
 }
 
 // Load Word Coprocessor
-void iLWC(Allegrex *allegrex, int copN, u32 instr) {
+template<Type type, int copN>
+void iLWC(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
     const auto imm = (i32)(i16)getImm(instr);
@@ -1021,7 +997,7 @@ void iLWC(Allegrex *allegrex, int copN, u32 instr) {
 
     assert(allegrex->cop0.isCOPUsable(copN));
 
-    const auto data = allegrex->read32(addr);
+    const auto data = read32<type>(addr);
 
     switch (copN) {
         case 1:
@@ -1035,6 +1011,7 @@ void iLWC(Allegrex *allegrex, int copN, u32 instr) {
 }
 
 /* Load Word Left */
+template<Type type>
 void iLWL(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -1050,10 +1027,11 @@ void iLWL(Allegrex *allegrex, u32 instr) {
     const auto shift = 24 - 8 * (addr & 3);
     const auto mask = ~(~0 << shift);
 
-    allegrex->set(rt, (allegrex->get(rt) & mask) | (allegrex->read32(addr & ~3) << shift));
+    allegrex->set(rt, (allegrex->get(rt) & mask) | (read32<type>(addr & ~3) << shift));
 }
 
 /* Load Word Right */
+template<Type type>
 void iLWR(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -1069,10 +1047,11 @@ void iLWR(Allegrex *allegrex, u32 instr) {
     const auto shift = 8 * (addr & 3);
     const auto mask = 0xFFFFFF00 << (24 - shift);
 
-    allegrex->set(rt, (allegrex->get(rt) & mask) | (allegrex->read32(addr & ~3) >> shift));
+    allegrex->set(rt, (allegrex->get(rt) & mask) | (read32<type>(addr & ~3) >> shift));
 }
 
 /* MAX */
+template<Type type>
 void iMAX(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -1090,7 +1069,8 @@ void iMAX(Allegrex *allegrex, u32 instr) {
 }
 
 // Move From Coprocessor
-void iMFC(Allegrex *allegrex, int copN, u32 instr) {
+template<Type type, int copN>
+void iMFC(Allegrex *allegrex, u32 instr) {
     assert((copN >= 0) && (copN < 4));
 
     const auto rd = getRd(instr);
@@ -1121,6 +1101,7 @@ void iMFC(Allegrex *allegrex, int copN, u32 instr) {
 }
 
 /* Move From HI */
+template<Type type>
 void iMFHI(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
 
@@ -1132,6 +1113,7 @@ void iMFHI(Allegrex *allegrex, u32 instr) {
 }
 
 // Move From Interrupt Control
+template<Type type>
 void iMFIC(Allegrex *allegrex, u32 instr) {
     const auto rt = getRt(instr);
 
@@ -1145,6 +1127,7 @@ void iMFIC(Allegrex *allegrex, u32 instr) {
 }
 
 /* Move From LO */
+template<Type type>
 void iMFLO(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
 
@@ -1156,8 +1139,10 @@ void iMFLO(Allegrex *allegrex, u32 instr) {
 }
 
 /* Move From VFPU Control */
+template<Type type>
 void iMFVC(Allegrex *allegrex, u32 instr) {
-    assert(!allegrex->isME());
+    assert(type != Type::MediaEngine);
+    assert(allegrex->cop0.isCOPUsable(2));
 
     const auto rt = getRt(instr);
 
@@ -1169,6 +1154,7 @@ void iMFVC(Allegrex *allegrex, u32 instr) {
 }
 
 /* MINimum */
+template<Type type>
 void iMIN(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -1186,6 +1172,7 @@ void iMIN(Allegrex *allegrex, u32 instr) {
 }
 
 /* MOVe if Not zero */
+template<Type type>
 void iMOVN(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -1199,6 +1186,7 @@ void iMOVN(Allegrex *allegrex, u32 instr) {
 }
 
 /* MOVe if Zero */
+template<Type type>
 void iMOVZ(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -1212,7 +1200,8 @@ void iMOVZ(Allegrex *allegrex, u32 instr) {
 }
 
 // Move To Coprocessor
-void iMTC(Allegrex *allegrex, int copN, u32 instr) {
+template<Type type, int copN>
+void iMTC(Allegrex *allegrex, u32 instr) {
     assert((copN >= 0) && (copN < 4));
 
     const auto rd = getRd(instr);
@@ -1243,6 +1232,7 @@ void iMTC(Allegrex *allegrex, int copN, u32 instr) {
 }
 
 /* Move To HI */
+template<Type type>
 void iMTHI(Allegrex *allegrex, u32 instr) {
     const auto rs = getRd(instr);
 
@@ -1254,6 +1244,7 @@ void iMTHI(Allegrex *allegrex, u32 instr) {
 }
 
 // Move To Interrupt Control
+template<Type type>
 void iMTIC(Allegrex *allegrex, u32 instr) {
     const auto rt = getRt(instr);
 
@@ -1267,6 +1258,7 @@ void iMTIC(Allegrex *allegrex, u32 instr) {
 }
 
 /* Move To LO */
+template<Type type>
 void iMTLO(Allegrex *allegrex, u32 instr) {
     const auto rs = getRd(instr);
 
@@ -1278,6 +1270,7 @@ void iMTLO(Allegrex *allegrex, u32 instr) {
 }
 
 /* MULTiply */
+template<Type type>
 void iMULT(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -1293,6 +1286,7 @@ void iMULT(Allegrex *allegrex, u32 instr) {
 }   
 
 /* MULTiply Unsigned */
+template<Type type>
 void iMULTU(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -1308,6 +1302,7 @@ void iMULTU(Allegrex *allegrex, u32 instr) {
 }   
 
 // NOR
+template<Type type>
 void iNOR(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -1321,6 +1316,7 @@ void iNOR(Allegrex *allegrex, u32 instr) {
 }
 
 // OR
+template<Type type>
 void iOR(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -1334,6 +1330,7 @@ void iOR(Allegrex *allegrex, u32 instr) {
 }
 
 // OR Immediate
+template<Type type>
 void iORI(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -1347,6 +1344,7 @@ void iORI(Allegrex *allegrex, u32 instr) {
 }
 
 // ROTate Right
+template<Type type>
 void iROTR(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rt = getRt(instr);
@@ -1360,6 +1358,7 @@ void iROTR(Allegrex *allegrex, u32 instr) {
 }
 
 // ROTate Right Variable
+template<Type type>
 void iROTRV(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -1376,6 +1375,7 @@ void iROTRV(Allegrex *allegrex, u32 instr) {
 }
 
 // Store Byte
+template<Type type>
 void iSB(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -1388,10 +1388,11 @@ void iSB(Allegrex *allegrex, u32 instr) {
         std::printf("[%s] [0x%08X] SB %s, 0x%X(%s); [0x%08X] = 0x%02X\n", allegrex->getTypeName(), cpc, regNames[rt], imm, regNames[rs], addr, data);
     }
 
-    allegrex->write8(addr, data);
+    write8<type>(addr, data);
 }
 
 /* Sign Extend Byte */
+template<Type type>
 void iSEB(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rt = getRt(instr);
@@ -1404,6 +1405,7 @@ void iSEB(Allegrex *allegrex, u32 instr) {
 }
 
 /* Sign Extend Halfword */
+template<Type type>
 void iSEH(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rt = getRt(instr);
@@ -1416,6 +1418,7 @@ void iSEH(Allegrex *allegrex, u32 instr) {
 }
 
 // Store Halfword
+template<Type type>
 void iSH(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -1434,10 +1437,11 @@ void iSH(Allegrex *allegrex, u32 instr) {
         exit(0);
     }
 
-    allegrex->write16(addr, data);
+    write16<type>(addr, data);
 }
 
 // Shift Left Logical
+template<Type type>
 void iSLL(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rt = getRt(instr);
@@ -1455,6 +1459,7 @@ void iSLL(Allegrex *allegrex, u32 instr) {
 }
 
 // Shift Left Logical Variable
+template<Type type>
 void iSLLV(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -1468,6 +1473,7 @@ void iSLLV(Allegrex *allegrex, u32 instr) {
 }
 
 /* Set on Less Than */
+template<Type type>
 void iSLT(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -1481,6 +1487,7 @@ void iSLT(Allegrex *allegrex, u32 instr) {
 }
 
 // Set on Less Than Immediate
+template<Type type>
 void iSLTI(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -1494,6 +1501,7 @@ void iSLTI(Allegrex *allegrex, u32 instr) {
 }
 
 // Set on Less Than Immediate Unsigned
+template<Type type>
 void iSLTIU(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -1507,6 +1515,7 @@ void iSLTIU(Allegrex *allegrex, u32 instr) {
 }
 
 /* Set on Less Than Unsigned */
+template<Type type>
 void iSLTU(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -1520,6 +1529,7 @@ void iSLTU(Allegrex *allegrex, u32 instr) {
 }
 
 // Shift Right Arithmetic
+template<Type type>
 void iSRA(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rt = getRt(instr);
@@ -1533,6 +1543,7 @@ void iSRA(Allegrex *allegrex, u32 instr) {
 }
 
 // Shift Right Arithmetic Variable
+template<Type type>
 void iSRAV(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -1546,6 +1557,7 @@ void iSRAV(Allegrex *allegrex, u32 instr) {
 }
 
 // Shift Right Logical
+template<Type type>
 void iSRL(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rt = getRt(instr);
@@ -1559,6 +1571,7 @@ void iSRL(Allegrex *allegrex, u32 instr) {
 }
 
 // Shift Right Logical Variable
+template<Type type>
 void iSRLV(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -1572,6 +1585,7 @@ void iSRLV(Allegrex *allegrex, u32 instr) {
 }
 
 // SUBtract
+template<Type type>
 void iSUB(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -1587,6 +1601,7 @@ void iSUB(Allegrex *allegrex, u32 instr) {
 }
 
 // SUBtract Unsigned
+template<Type type>
 void iSUBU(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -1600,8 +1615,9 @@ void iSUBU(Allegrex *allegrex, u32 instr) {
 }
 
 // Store Vector Quadword
+template<Type type>
 void iSVQ(Allegrex *allegrex, u32 instr) {
-    assert(!allegrex->isME());
+    assert(type != Type::MediaEngine);
 
     const auto rs = getRs(instr);
     const auto rt = getRt(instr) | ((instr & 1 ) << 6);
@@ -1622,6 +1638,7 @@ void iSVQ(Allegrex *allegrex, u32 instr) {
 }
 
 // Store Word
+template<Type type>
 void iSW(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -1644,11 +1661,12 @@ void iSW(Allegrex *allegrex, u32 instr) {
         exit(0);
     }
 
-    allegrex->write32(addr, data);
+    write32<type>(addr, data);
 }
 
 // Store Word Coprocessor
-void iSWC(Allegrex *allegrex, int copN, u32 instr) {
+template<Type type, int copN>
+void iSWC(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
     const auto imm = (i32)(i16)getImm(instr);
@@ -1678,10 +1696,11 @@ void iSWC(Allegrex *allegrex, int copN, u32 instr) {
         exit(0);
     }
 
-    allegrex->write32(addr, data);
+    write32<type>(addr, data);
 }
 
 /* Store Word Left */
+template<Type type>
 void iSWL(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -1693,16 +1712,17 @@ void iSWL(Allegrex *allegrex, u32 instr) {
     const auto shift = 8 * (addr & 3);
     const auto mask  = 0xFFFFFF00 << shift;
 
-    const auto data = (allegrex->read32(addr & ~3) & mask) | (allegrex->get(rt) >> (24 - shift));
+    const auto data = (read32<type>(addr & ~3) & mask) | (allegrex->get(rt) >> (24 - shift));
 
     if (ENABLE_DISASM) {
         std::printf("[%s] [0x%08X] SWL %s, 0x%X(%s); [0x%08X] = 0x%08X\n", allegrex->getTypeName(), cpc, regNames[rt], imm, regNames[rs], addr, data);
     }
 
-    allegrex->write32(addr & ~3, data);
+    write32<type>(addr & ~3, data);
 }
 
 /* Store Word Right */
+template<Type type>
 void iSWR(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -1714,16 +1734,17 @@ void iSWR(Allegrex *allegrex, u32 instr) {
     const auto shift = 8 * (addr & 3);
     const auto mask  = ~(~0 << shift);
 
-    const auto data = (allegrex->read32(addr & ~3) & mask) | (allegrex->get(rt) << shift);
+    const auto data = (read32<type>(addr & ~3) & mask) | (allegrex->get(rt) << shift);
 
     if (ENABLE_DISASM) {
         std::printf("[%s] [0x%08X] SWR %s, 0x%X(%s); [0x%08X] = 0x%08X\n", allegrex->getTypeName(), cpc, regNames[rt], imm, regNames[rs], addr, data);
     }
 
-    allegrex->write32(addr & ~3, data);
+    write32<type>(addr & ~3, data);
 }
 
 // SYNC
+template<Type type>
 void iSYNC(Allegrex *allegrex, u32 instr) {
     (void)instr;
 
@@ -1733,6 +1754,7 @@ void iSYNC(Allegrex *allegrex, u32 instr) {
 }
 
 // SYStem CALL
+template<Type type>
 void iSYSCALL(Allegrex *allegrex, u32 instr) {
     (void)instr;
 
@@ -1764,6 +1786,7 @@ void iSYSCALL(Allegrex *allegrex, u32 instr) {
 }
 
 // XOR
+template<Type type>
 void iXOR(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rs = getRs(instr);
@@ -1777,6 +1800,7 @@ void iXOR(Allegrex *allegrex, u32 instr) {
 }
 
 // XOR Immediate
+template<Type type>
 void iXORI(Allegrex *allegrex, u32 instr) {
     const auto rs = getRs(instr);
     const auto rt = getRt(instr);
@@ -1790,6 +1814,7 @@ void iXORI(Allegrex *allegrex, u32 instr) {
 }
 
 /* Word Swap Bytes within Halfword */
+template<Type type>
 void iWSBH(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rt = getRt(instr);
@@ -1804,6 +1829,7 @@ void iWSBH(Allegrex *allegrex, u32 instr) {
 }
 
 /* Word Swap Bytes within Word */
+template<Type type>
 void iWSBW(Allegrex *allegrex, u32 instr) {
     const auto rd = getRd(instr);
     const auto rt = getRt(instr);
@@ -1817,486 +1843,915 @@ void iWSBW(Allegrex *allegrex, u32 instr) {
     }
 }
 
-i64 doInstr(Allegrex *allegrex) {
-    const auto instr = allegrex->read32(cpc);
+// Instruction IDs and their handlers
+#define INSTR_LIST(X) \
+    X(Invalid, iInvalid<type>) \
+    X(SLL, iSLL<type>) \
+    X(SRL, iSRL<type>) \
+    X(ROTR, iROTR<type>) \
+    X(SRA, iSRA<type>) \
+    X(SLLV, iSLLV<type>) \
+    X(SRLV, iSRLV<type>) \
+    X(ROTRV, iROTRV<type>) \
+    X(SRAV, iSRAV<type>) \
+    X(JR, iJR<type>) \
+    X(JALR, iJALR<type>) \
+    X(MOVZ, iMOVZ<type>) \
+    X(MOVN, iMOVN<type>) \
+    X(SYSCALL, iSYSCALL<type>) \
+    X(SYNC, iSYNC<type>) \
+    X(MFHI, iMFHI<type>) \
+    X(MTHI, iMTHI<type>) \
+    X(MFLO, iMFLO<type>) \
+    X(MTLO, iMTLO<type>) \
+    X(CLZ, iCLZ<type>) \
+    X(MULTU, iMULTU<type>) \
+    X(DIV, iDIV<type>) \
+    X(DIVU, iDIVU<type>) \
+    X(ADD, iADD<type>) \
+    X(ADDU, iADDU<type>) \
+    X(SUB, iSUB<type>) \
+    X(SUBU, iSUBU<type>) \
+    X(AND, iAND<type>) \
+    X(OR, iOR<type>) \
+    X(XOR, iXOR<type>) \
+    X(NOR, iNOR<type>) \
+    X(SLT, iSLT<type>) \
+    X(SLTU, iSLTU<type>) \
+    X(MAX, iMAX<type>) \
+    X(MIN, iMIN<type>) \
+    X(BLTZ, iBLTZ<type>) \
+    X(BGEZ, iBGEZ<type>) \
+    X(BLTZL, iBLTZL<type>) \
+    X(BGEZL, iBGEZL<type>) \
+    X(BLTZAL, iBLTZAL<type>) \
+    X(BGEZAL, iBGEZAL<type>) \
+    X(J, iJ<type>) \
+    X(JAL, iJAL<type>) \
+    X(BEQ, iBEQ<type>) \
+    X(BNE, iBNE<type>) \
+    X(BLEZ, iBLEZ<type>) \
+    X(BGTZ, iBGTZ<type>) \
+    X(ADDI, iADDI<type>) \
+    X(ADDIU, iADDIU<type>) \
+    X(SLTI, iSLTI<type>) \
+    X(SLTIU, iSLTIU<type>) \
+    X(ANDI, iANDI<type>) \
+    X(ORI, iORI<type>) \
+    X(XORI, iXORI<type>) \
+    X(LUI, iLUI<type>) \
+    X(MFC0, (iMFC<type, 0>)) \
+    X(CFC0, (iCFC<type, 0>)) \
+    X(MTC0, (iMTC<type, 0>)) \
+    X(CTC0, (iCTC<type, 0>)) \
+    X(ERET, iERET<type>) \
+    X(MFC1, (iMFC<type, 1>)) \
+    X(CFC1, (iCFC<type, 1>)) \
+    X(MTC1, (iMTC<type, 1>)) \
+    X(CTC1, (iCTC<type, 1>)) \
+    X(BC1F, (iBCF<type, 1>)) \
+    X(BC1T, (iBCT<type, 1>)) \
+    X(BC1FL, (iBCFL<type, 1>)) \
+    X(BC1TL, (iBCTL<type, 1>)) \
+    X(FPUSingle, iFPUSingle<type>) \
+    X(FPUWord, iFPUWord<type>) \
+    X(MFVC, iMFVC<type>) \
+    X(BEQL, iBEQL<type>) \
+    X(BNEL, iBNEL<type>) \
+    X(BLEZL, iBLEZL<type>) \
+    X(BGTZL, iBGTZL<type>) \
+    X(HALT, iHALT<type>) \
+    X(MFIC, iMFIC<type>) \
+    X(MTIC, iMTIC<type>) \
+    X(EXT, iEXT<type>) \
+    X(INS, iINS<type>) \
+    X(WSBH, iWSBH<type>) \
+    X(WSBW, iWSBW<type>) \
+    X(SEB, iSEB<type>) \
+    X(BITREV, iBITREV<type>) \
+    X(SEH, iSEH<type>) \
+    X(LB, iLB<type>) \
+    X(LH, iLH<type>) \
+    X(LWL, iLWL<type>) \
+    X(LW, iLW<type>) \
+    X(LBU, iLBU<type>) \
+    X(LHU, iLHU<type>) \
+    X(LWR, iLWR<type>) \
+    X(SB, iSB<type>) \
+    X(SH, iSH<type>) \
+    X(SWL, iSWL<type>) \
+    X(SW, iSW<type>) \
+    X(SWR, iSWR<type>) \
+    X(CACHE, iCACHE<type>) \
+    X(LWC1, (iLWC<type, 1>)) \
+    X(SWC1, (iSWC<type, 1>)) \
+    X(SVQ, iSVQ<type>)
+
+enum class InstrID : u8 {
+#define X(name, func) name,
+    INSTR_LIST(X)
+#undef X
+    NumIDs,
+};
+
+template<Type type>
+const InstrFunc handlers[] = {
+#define X(name, func) &func,
+    INSTR_LIST(X)
+#undef X
+};
+
+// Decode tables, indexed by an instruction field
+enum DecodeTableID {
+    TABLE_PRIMARY,
+    TABLE_SPECIAL,
+    TABLE_SRL,
+    TABLE_SRLV,
+    TABLE_REGIMM,
+    TABLE_COP0,
+    TABLE_COP0_CO,
+    TABLE_COP1,
+    TABLE_COP1_BC,
+    TABLE_COP2,
+    TABLE_SPECIAL2,
+    TABLE_SPECIAL3,
+    TABLE_BSHFL,
+    NUM_TABLES,
+};
+
+// Entries >= TABLE_BASE select another decode table
+constexpr u8 TABLE_BASE = 0x80;
+
+static_assert((u8)InstrID::NumIDs <= TABLE_BASE);
+
+struct DecodeTable {
+    u32 shift, mask; // Instruction field
+
+    std::array<u8, 64> entries;
+};
+
+constexpr auto makeDecodeTables() {
+    std::array<DecodeTable, NUM_TABLES> tables{};
+
+    for (auto &table : tables) {
+        table.entries.fill((u8)InstrID::Invalid);
+    }
+
+    const auto setField = [&tables](DecodeTableID table, u32 shift, u32 mask) {
+        tables[table].shift = shift;
+        tables[table].mask  = mask;
+    };
+
+    const auto setInstr = [&tables](DecodeTableID table, auto idx, InstrID id) {
+        tables[table].entries[(u32)idx] = (u8)id;
+    };
+
+    const auto setTable = [&tables](DecodeTableID table, auto idx, DecodeTableID next) {
+        tables[table].entries[(u32)idx] = TABLE_BASE + next;
+    };
+
+    setField(TABLE_PRIMARY, 26, 0x3F);
+    setField(TABLE_SPECIAL, 0, 0x3F);
+    setField(TABLE_SRL, 21, 0x1F);
+    setField(TABLE_SRLV, 6, 0x1F);
+    setField(TABLE_REGIMM, 16, 0x1F);
+    setField(TABLE_COP0, 21, 0x1F);
+    setField(TABLE_COP0_CO, 0, 0x3F);
+    setField(TABLE_COP1, 21, 0x1F);
+    setField(TABLE_COP1_BC, 16, 0x1F);
+    setField(TABLE_COP2, 21, 0x1F);
+    setField(TABLE_SPECIAL2, 0, 0x3F);
+    setField(TABLE_SPECIAL3, 0, 0x3F);
+    setField(TABLE_BSHFL, 6, 0x1F);
+
+    setTable(TABLE_PRIMARY, Opcode::SPECIAL, TABLE_SPECIAL);
+    setTable(TABLE_PRIMARY, Opcode::REGIMM, TABLE_REGIMM);
+    setInstr(TABLE_PRIMARY, Opcode::J, InstrID::J);
+    setInstr(TABLE_PRIMARY, Opcode::JAL, InstrID::JAL);
+    setInstr(TABLE_PRIMARY, Opcode::BEQ, InstrID::BEQ);
+    setInstr(TABLE_PRIMARY, Opcode::BNE, InstrID::BNE);
+    setInstr(TABLE_PRIMARY, Opcode::BLEZ, InstrID::BLEZ);
+    setInstr(TABLE_PRIMARY, Opcode::BGTZ, InstrID::BGTZ);
+    setInstr(TABLE_PRIMARY, Opcode::ADDI, InstrID::ADDI);
+    setInstr(TABLE_PRIMARY, Opcode::ADDIU, InstrID::ADDIU);
+    setInstr(TABLE_PRIMARY, Opcode::SLTI, InstrID::SLTI);
+    setInstr(TABLE_PRIMARY, Opcode::SLTIU, InstrID::SLTIU);
+    setInstr(TABLE_PRIMARY, Opcode::ANDI, InstrID::ANDI);
+    setInstr(TABLE_PRIMARY, Opcode::ORI, InstrID::ORI);
+    setInstr(TABLE_PRIMARY, Opcode::XORI, InstrID::XORI);
+    setInstr(TABLE_PRIMARY, Opcode::LUI, InstrID::LUI);
+    setTable(TABLE_PRIMARY, Opcode::COP0, TABLE_COP0);
+    setTable(TABLE_PRIMARY, Opcode::COP1, TABLE_COP1);
+    setTable(TABLE_PRIMARY, Opcode::COP2, TABLE_COP2);
+    setInstr(TABLE_PRIMARY, Opcode::BEQL, InstrID::BEQL);
+    setInstr(TABLE_PRIMARY, Opcode::BNEL, InstrID::BNEL);
+    setInstr(TABLE_PRIMARY, Opcode::BLEZL, InstrID::BLEZL);
+    setInstr(TABLE_PRIMARY, Opcode::BGTZL, InstrID::BGTZL);
+    setTable(TABLE_PRIMARY, Opcode::SPECIAL2, TABLE_SPECIAL2);
+    setTable(TABLE_PRIMARY, Opcode::SPECIAL3, TABLE_SPECIAL3);
+    setInstr(TABLE_PRIMARY, Opcode::LB, InstrID::LB);
+    setInstr(TABLE_PRIMARY, Opcode::LH, InstrID::LH);
+    setInstr(TABLE_PRIMARY, Opcode::LWL, InstrID::LWL);
+    setInstr(TABLE_PRIMARY, Opcode::LW, InstrID::LW);
+    setInstr(TABLE_PRIMARY, Opcode::LBU, InstrID::LBU);
+    setInstr(TABLE_PRIMARY, Opcode::LHU, InstrID::LHU);
+    setInstr(TABLE_PRIMARY, Opcode::LWR, InstrID::LWR);
+    setInstr(TABLE_PRIMARY, Opcode::SB, InstrID::SB);
+    setInstr(TABLE_PRIMARY, Opcode::SH, InstrID::SH);
+    setInstr(TABLE_PRIMARY, Opcode::SWL, InstrID::SWL);
+    setInstr(TABLE_PRIMARY, Opcode::SW, InstrID::SW);
+    setInstr(TABLE_PRIMARY, Opcode::SWR, InstrID::SWR);
+    setInstr(TABLE_PRIMARY, Opcode::CACHE, InstrID::CACHE);
+    setInstr(TABLE_PRIMARY, Opcode::LWC1, InstrID::LWC1);
+    setInstr(TABLE_PRIMARY, Opcode::SWC1, InstrID::SWC1);
+    setInstr(TABLE_PRIMARY, Opcode::SQC2, InstrID::SVQ);
+
+    setInstr(TABLE_SPECIAL, SPECIAL::SLL, InstrID::SLL);
+    setTable(TABLE_SPECIAL, SPECIAL::SRL, TABLE_SRL);
+    setInstr(TABLE_SPECIAL, SPECIAL::SRA, InstrID::SRA);
+    setInstr(TABLE_SPECIAL, SPECIAL::SLLV, InstrID::SLLV);
+    setTable(TABLE_SPECIAL, SPECIAL::SRLV, TABLE_SRLV);
+    setInstr(TABLE_SPECIAL, SPECIAL::SRAV, InstrID::SRAV);
+    setInstr(TABLE_SPECIAL, SPECIAL::JR, InstrID::JR);
+    setInstr(TABLE_SPECIAL, SPECIAL::JALR, InstrID::JALR);
+    setInstr(TABLE_SPECIAL, SPECIAL::MOVZ, InstrID::MOVZ);
+    setInstr(TABLE_SPECIAL, SPECIAL::MOVN, InstrID::MOVN);
+    setInstr(TABLE_SPECIAL, SPECIAL::SYSCALL, InstrID::SYSCALL);
+    setInstr(TABLE_SPECIAL, SPECIAL::SYNC, InstrID::SYNC);
+    setInstr(TABLE_SPECIAL, SPECIAL::MFHI, InstrID::MFHI);
+    setInstr(TABLE_SPECIAL, SPECIAL::MTHI, InstrID::MTHI);
+    setInstr(TABLE_SPECIAL, SPECIAL::MFLO, InstrID::MFLO);
+    setInstr(TABLE_SPECIAL, SPECIAL::MTLO, InstrID::MTLO);
+    setInstr(TABLE_SPECIAL, SPECIAL::CLZ, InstrID::CLZ);
+    setInstr(TABLE_SPECIAL, SPECIAL::MULT, InstrID::MULTU);
+    setInstr(TABLE_SPECIAL, SPECIAL::MULTU, InstrID::MULTU);
+    setInstr(TABLE_SPECIAL, SPECIAL::DIV, InstrID::DIV);
+    setInstr(TABLE_SPECIAL, SPECIAL::DIVU, InstrID::DIVU);
+    setInstr(TABLE_SPECIAL, SPECIAL::ADD, InstrID::ADD);
+    setInstr(TABLE_SPECIAL, SPECIAL::ADDU, InstrID::ADDU);
+    setInstr(TABLE_SPECIAL, SPECIAL::SUB, InstrID::SUB);
+    setInstr(TABLE_SPECIAL, SPECIAL::SUBU, InstrID::SUBU);
+    setInstr(TABLE_SPECIAL, SPECIAL::AND, InstrID::AND);
+    setInstr(TABLE_SPECIAL, SPECIAL::OR, InstrID::OR);
+    setInstr(TABLE_SPECIAL, SPECIAL::XOR, InstrID::XOR);
+    setInstr(TABLE_SPECIAL, SPECIAL::NOR, InstrID::NOR);
+    setInstr(TABLE_SPECIAL, SPECIAL::SLT, InstrID::SLT);
+    setInstr(TABLE_SPECIAL, SPECIAL::SLTU, InstrID::SLTU);
+    setInstr(TABLE_SPECIAL, SPECIAL::MAX, InstrID::MAX);
+    setInstr(TABLE_SPECIAL, SPECIAL::MIN, InstrID::MIN);
+
+    setInstr(TABLE_SRL, 0, InstrID::SRL);
+    setInstr(TABLE_SRL, 1, InstrID::ROTR);
+
+    setInstr(TABLE_SRLV, 0, InstrID::SRLV);
+    setInstr(TABLE_SRLV, 1, InstrID::ROTRV);
+
+    setInstr(TABLE_REGIMM, REGIMM::BLTZ, InstrID::BLTZ);
+    setInstr(TABLE_REGIMM, REGIMM::BGEZ, InstrID::BGEZ);
+    setInstr(TABLE_REGIMM, REGIMM::BLTZL, InstrID::BLTZL);
+    setInstr(TABLE_REGIMM, REGIMM::BGEZL, InstrID::BGEZL);
+    setInstr(TABLE_REGIMM, REGIMM::BLTZAL, InstrID::BLTZAL);
+    setInstr(TABLE_REGIMM, REGIMM::BGEZAL, InstrID::BGEZAL);
+
+    setInstr(TABLE_COP0, COPOpcode::MFC, InstrID::MFC0);
+    setInstr(TABLE_COP0, COPOpcode::CFC, InstrID::CFC0);
+    setInstr(TABLE_COP0, COPOpcode::MTC, InstrID::MTC0);
+    setInstr(TABLE_COP0, COPOpcode::CTC, InstrID::CTC0);
+    setTable(TABLE_COP0, COPOpcode::CO, TABLE_COP0_CO);
+
+    setInstr(TABLE_COP0_CO, COP0Opcode::ERET, InstrID::ERET);
+
+    setInstr(TABLE_COP1, COPOpcode::MFC, InstrID::MFC1);
+    setInstr(TABLE_COP1, COPOpcode::CFC, InstrID::CFC1);
+    setInstr(TABLE_COP1, COPOpcode::MTC, InstrID::MTC1);
+    setInstr(TABLE_COP1, COPOpcode::CTC, InstrID::CTC1);
+    setTable(TABLE_COP1, COPOpcode::BC, TABLE_COP1_BC);
+    setInstr(TABLE_COP1, COPOpcode::CO, InstrID::FPUSingle); // Actually Single instructions
+    setInstr(TABLE_COP1, COPOpcode::W, InstrID::FPUWord);
+
+    setInstr(TABLE_COP1_BC, BC::BCF, InstrID::BC1F);
+    setInstr(TABLE_COP1_BC, BC::BCT, InstrID::BC1T);
+    setInstr(TABLE_COP1_BC, BC::BCFL, InstrID::BC1FL);
+    setInstr(TABLE_COP1_BC, BC::BCTL, InstrID::BC1TL);
+
+    setInstr(TABLE_COP2, COPOpcode::MFHC, InstrID::MFVC);
+
+    setInstr(TABLE_SPECIAL2, SPECIAL2::HALT, InstrID::HALT);
+    setInstr(TABLE_SPECIAL2, SPECIAL2::MFIC, InstrID::MFIC);
+    setInstr(TABLE_SPECIAL2, SPECIAL2::MTIC, InstrID::MTIC);
+
+    setInstr(TABLE_SPECIAL3, SPECIAL3::EXT, InstrID::EXT);
+    setInstr(TABLE_SPECIAL3, SPECIAL3::INS, InstrID::INS);
+    setTable(TABLE_SPECIAL3, SPECIAL3::BSHFL, TABLE_BSHFL);
+
+    setInstr(TABLE_BSHFL, BSHFL::WSBH, InstrID::WSBH);
+    setInstr(TABLE_BSHFL, BSHFL::WSBW, InstrID::WSBW);
+    setInstr(TABLE_BSHFL, BSHFL::SEB, InstrID::SEB);
+    setInstr(TABLE_BSHFL, BSHFL::BITREV, InstrID::BITREV);
+    setInstr(TABLE_BSHFL, BSHFL::SEH, InstrID::SEH);
+
+    return tables;
+}
+
+constexpr auto decodeTables = makeDecodeTables();
+
+// Returns the instruction ID of instr
+inline InstrID decodeID(u32 instr) {
+    u8 entry = TABLE_BASE + TABLE_PRIMARY;
+
+    do {
+        const auto &table = decodeTables[entry - TABLE_BASE];
+
+        entry = table.entries[(instr >> table.shift) & table.mask];
+    } while (entry >= TABLE_BASE);
+
+    return (InstrID)entry;
+}
+
+// Returns the handler for instr, specialized for the CPU type
+InstrFunc decode(Allegrex *allegrex, u32 instr) {
+    if (allegrex->isME()) return handlers<Type::MediaEngine>[(u8)decodeID(instr)];
+
+    return handlers<Type::Allegrex>[(u8)decodeID(instr)];
+}
+
+// Instruction pairs that are fused in decoded blocks. Only the cached interpreter runs fused ops, the plain interpreter
+// would still have to fetch and decode the second instruction. MULT and MULTU share the MULTU handler, so MULTU covers both.
+// LUI+ORI/ADDIU constant builds are folded by the block optimizer instead
+#define FUSED_LIST(X) \
+    X(SLT, BEQ) \
+    X(SLT, BNE) \
+    X(SLTU, BEQ) \
+    X(SLTU, BNE) \
+    X(MULTU, MFLO) \
+    X(LWL, LWR) \
+    X(LWR, LWL) \
+    X(SWL, SWR) \
+    X(SWR, SWL)
+
+// Runs two instructions with one dispatch, the second handler sees the same state as after its own dispatch
+template<Type type, InstrFunc first, InstrFunc second>
+void doFused(Allegrex *allegrex, u32 instr1, u32 instr2) {
+    first(allegrex, instr1);
+
+    // Device accesses catch up the scheduler, an interrupt raised there leaves the block before the second instruction
+    if (allegrex->isHalted || (allegrex->getPC() != (cpc + 4))) return;
+
+    cpc += 4;
 
     allegrex->advancePC();
 
-    // Get and decode opcode
-    const auto opcode = getOpcode(instr);
+    // Counted before the handler runs, device accesses catch up to the current instruction
+    allegrex->cycles++;
 
-    switch ((Opcode)opcode) {
+    second(allegrex, instr2);
+}
+
+template<Type type>
+ir::FusedFunc getFusedType(u32 instr1, u32 instr2) {
+    const auto id1 = decodeID(instr1);
+    const auto id2 = decodeID(instr2);
+
+#define X(name1, name2) if ((id1 == InstrID::name1) && (id2 == InstrID::name2)) return &doFused<type, &i##name1<type>, &i##name2<type>>;
+    FUSED_LIST(X)
+#undef X
+
+    return NULL;
+}
+
+#undef FUSED_LIST
+
+ir::FusedFunc getFused(Allegrex *allegrex, u32 instr1, u32 instr2) {
+    if (allegrex->isME()) return getFusedType<Type::MediaEngine>(instr1, instr2);
+
+    return getFusedType<Type::Allegrex>(instr1, instr2);
+}
+
+bool isBranch(u32 instr) {
+    switch ((Opcode)getOpcode(instr)) {
         case Opcode::SPECIAL:
             {
                 const auto funct = getFunct(instr);
 
-                switch ((SPECIAL)funct) {
-                    case SPECIAL::SLL:
-                        iSLL(allegrex, instr);
-                        break;
-                    case SPECIAL::SRL:
-                        {
-                            const auto rs = getRs(instr);
-
-                            switch (rs) {
-                                case 0:
-                                    iSRL(allegrex, instr);
-                                    break;
-                                case 1:
-                                    iROTR(allegrex, instr);
-                                    break;
-                                default:
-                                    std::printf("Invalid %s instruction 0x%02X:0x%02X (0x%08X) @ 0x%08X\n", allegrex->getTypeName(), funct, rs, instr, cpc);
-
-                                    exit(0);
-                            }
-                        }
-                        break;
-                    case SPECIAL::SRA:
-                        iSRA(allegrex, instr);
-                        break;
-                    case SPECIAL::SLLV:
-                        iSLLV(allegrex, instr);
-                        break;
-                    case SPECIAL::SRLV:
-                        {
-                            const auto shamt = getShamt(instr);
-
-                            switch (shamt) {
-                                case 0:
-                                    iSRLV(allegrex, instr);
-                                    break;
-                                case 1:
-                                    iROTRV(allegrex, instr);
-                                    break;
-                                default:
-                                    std::printf("Invalid %s instruction 0x%02X:0x%02X (0x%08X) @ 0x%08X\n", allegrex->getTypeName(), funct, shamt, instr, cpc);
-
-                                    exit(0);
-                            }
-                        }
-                        break;
-                    case SPECIAL::SRAV:
-                        iSRAV(allegrex, instr);
-                        break;
-                    case SPECIAL::JR:
-                        iJR(allegrex, instr);
-                        break;
-                    case SPECIAL::JALR:
-                        iJALR(allegrex, instr);
-                        break;
-                    case SPECIAL::MOVZ:
-                        iMOVZ(allegrex, instr);
-                        break;
-                    case SPECIAL::MOVN:
-                        iMOVN(allegrex, instr);
-                        break;
-                    case SPECIAL::SYSCALL:
-                        iSYSCALL(allegrex, instr);
-                        break;
-                    case SPECIAL::SYNC:
-                        iSYNC(allegrex, instr);
-                        break;
-                    case SPECIAL::MFHI:
-                        iMFHI(allegrex, instr);
-                        break;
-                    case SPECIAL::MTHI:
-                        iMTHI(allegrex, instr);
-                        break;
-                    case SPECIAL::MFLO:
-                        iMFLO(allegrex, instr);
-                        break;
-                    case SPECIAL::MTLO:
-                        iMTLO(allegrex, instr);
-                        break;
-                    case SPECIAL::CLZ:
-                        iCLZ(allegrex, instr);
-                        break;
-                    case SPECIAL::MULT:
-                        iMULTU(allegrex, instr);
-                        break;
-                    case SPECIAL::MULTU:
-                        iMULTU(allegrex, instr);
-                        break;
-                    case SPECIAL::DIV:
-                        iDIV(allegrex, instr);
-                        break;
-                    case SPECIAL::DIVU:
-                        iDIVU(allegrex, instr);
-                        break;
-                    case SPECIAL::ADD:
-                        iADD(allegrex, instr);
-                        break;
-                    case SPECIAL::ADDU:
-                        iADDU(allegrex, instr);
-                        break;
-                    case SPECIAL::SUB:
-                        iSUB(allegrex, instr);
-                        break;
-                    case SPECIAL::SUBU:
-                        iSUBU(allegrex, instr);
-                        break;
-                    case SPECIAL::AND:
-                        iAND(allegrex, instr);
-                        break;
-                    case SPECIAL::OR:
-                        iOR(allegrex, instr);
-                        break;
-                    case SPECIAL::XOR:
-                        iXOR(allegrex, instr);
-                        break;
-                    case SPECIAL::NOR:
-                        iNOR(allegrex, instr);
-                        break;
-                    case SPECIAL::SLT:
-                        iSLT(allegrex, instr);
-                        break;
-                    case SPECIAL::SLTU:
-                        iSLTU(allegrex, instr);
-                        break;
-                    case SPECIAL::MAX:
-                        iMAX(allegrex, instr);
-                        break;
-                    case SPECIAL::MIN:
-                        iMIN(allegrex, instr);
-                        break;
-                    default:
-                        std::printf("Unhandled %s SPECIAL instruction 0x%02X (0x%08X) @ 0x%08X\n", allegrex->getTypeName(), funct, instr, cpc);
-
-                        exit(0);
-                }
+                return ((SPECIAL)funct == SPECIAL::JR) || ((SPECIAL)funct == SPECIAL::JALR);
             }
-            break;
         case Opcode::REGIMM:
-            {
-                const auto rt = getRt(instr);
-
-                switch ((REGIMM)rt) {
-                    case REGIMM::BLTZ:
-                        iBLTZ(allegrex, instr);
-                        break;
-                    case REGIMM::BGEZ:
-                        iBGEZ(allegrex, instr);
-                        break;
-                    case REGIMM::BLTZL:
-                        iBLTZL(allegrex, instr);
-                        break;
-                    case REGIMM::BGEZL:
-                        iBGEZL(allegrex, instr);
-                        break;
-                    case REGIMM::BLTZAL:
-                        iBLTZAL(allegrex, instr);
-                        break;
-                    case REGIMM::BGEZAL:
-                        iBGEZAL(allegrex, instr);
-                        break;
-                    default:
-                        std::printf("Unhandled %s REGIMM instruction 0x%02X (0x%08X) @ 0x%08X\n", allegrex->getTypeName(), rt, instr, cpc);
-
-                        exit(0);
-                }
-            }
-            break;
         case Opcode::J:
-            iJ(allegrex, instr);
-            break;
         case Opcode::JAL:
-            iJAL(allegrex, instr);
-            break;
         case Opcode::BEQ:
-            iBEQ(allegrex, instr);
-            break;
         case Opcode::BNE:
-            iBNE(allegrex, instr);
-            break;
         case Opcode::BLEZ:
-            iBLEZ(allegrex, instr);
-            break;
         case Opcode::BGTZ:
-            iBGTZ(allegrex, instr);
-            break;
-        case Opcode::ADDI:
-            iADDI(allegrex, instr);
-            break;
-        case Opcode::ADDIU:
-            iADDIU(allegrex, instr);
-            break;
-        case Opcode::SLTI:
-            iSLTI(allegrex, instr);
-            break;
-        case Opcode::SLTIU:
-            iSLTIU(allegrex, instr);
-            break;
-        case Opcode::ANDI:
-            iANDI(allegrex, instr);
-            break;
-        case Opcode::ORI:
-            iORI(allegrex, instr);
-            break;
-        case Opcode::XORI:
-            iXORI(allegrex, instr);
-            break;
-        case Opcode::LUI:
-            iLUI(allegrex, instr);
-            break;
-        case Opcode::COP0:
-            {
-                const auto rs = getRs(instr);
-
-                switch ((COPOpcode)rs) {
-                    case COPOpcode::MFC:
-                        iMFC(allegrex, 0, instr);
-                        break;
-                    case COPOpcode::CFC:
-                        iCFC(allegrex, 0, instr);
-                        break;
-                    case COPOpcode::MTC:
-                        iMTC(allegrex, 0, instr);
-                        break;
-                    case COPOpcode::CTC:
-                        iCTC(allegrex, 0, instr);
-                        break;
-                    case COPOpcode::CO:
-                        {
-                            const auto funct = getFunct(instr);
-
-                            switch ((COP0Opcode)funct) {
-                                case COP0Opcode::ERET:
-                                    iERET(allegrex, instr);
-                                    break;
-                                default:
-                                    std::printf("Unhandled %s COP0 operation 0x%02X (0x%08X) @ 0x%08X\n", allegrex->getTypeName(), funct, instr, cpc);
-
-                                    exit(0);
-                            }
-                        }
-                        break;
-                    default:
-                        std::printf("Unhandled %s coprocessor instruction 0x%02X (0x%08X) @ 0x%08X\n", allegrex->getTypeName(), rs, instr, cpc);
-
-                        exit(0);
-                }
-            }
-            break;
+        case Opcode::BEQL:
+        case Opcode::BNEL:
+        case Opcode::BLEZL:
+        case Opcode::BGTZL:
+            return true;
         case Opcode::COP1:
-            {
-                assert(allegrex->cop0.isCOPUsable(1));
-
-                const auto rs = getRs(instr);
-
-                switch ((COPOpcode)rs) {
-                    case COPOpcode::MFC:
-                        iMFC(allegrex, 1, instr);
-                        break;
-                    case COPOpcode::CFC:
-                        iCFC(allegrex, 1, instr);
-                        break;
-                    case COPOpcode::MTC:
-                        iMTC(allegrex, 1, instr);
-                        break;
-                    case COPOpcode::CTC:
-                        iCTC(allegrex, 1, instr);
-                        break;
-                    case COPOpcode::BC:
-                        {
-                            const auto rt = getRt(instr);
-
-                            switch ((BC)rt) {
-                                case BC::BCF:
-                                    iBCF(allegrex, 1, instr);
-                                    break;
-                                case BC::BCT:
-                                    iBCT(allegrex, 1, instr);
-                                    break;
-                                case BC::BCFL:
-                                    iBCFL(allegrex, 1, instr);
-                                    break;
-                                case BC::BCTL:
-                                    iBCTL(allegrex, 1, instr);
-                                    break;
-                                default:
-                                    std::printf("Unhandled %s COP1 branch instruction 0x%02X (0x%08X) @ 0x%08X\n", allegrex->getTypeName(), rt, instr, cpc);
-
-                                    exit(0);
-                            }
-                        }
-                        break;
-                    case COPOpcode::CO: // Actually Single instructions
-                        allegrex->fpu.doSingle(instr);
-                        break;
-                    case COPOpcode::W:
-                        allegrex->fpu.doWord(instr);
-                        break;
-                    default:
-                        std::printf("Unhandled %s coprocessor instruction 0x%02X (0x%08X) @ 0x%08X\n", allegrex->getTypeName(), rs, instr, cpc);
-
-                        exit(0);
-                }
-            }
-            break;
-        case Opcode::COP2:
-            {
-                assert(allegrex->cop0.isCOPUsable(2));
+            return (COPOpcode)getRs(instr) == COPOpcode::BC;
+        default:
+            return false;
+    }
+}
 
-                const auto rs = getRs(instr);
+// Returns the GPRs read and written by instr, false if instr may have side effects
+bool getIdleRegUsage(u32 instr, u32 &reads, u32 &writes) {
+    const auto rd = getRd(instr);
+    const auto rs = getRs(instr);
+    const auto rt = getRt(instr);
 
-                switch ((COPOpcode)rs) {
-                    case COPOpcode::MFHC:
-                        iMFVC(allegrex, instr);
-                        break;
-                    default:
-                        std::printf("Unhandled %s coprocessor 2 instruction 0x%02X (0x%08X) @ 0x%08X\n", allegrex->getTypeName(), rs, instr, cpc);
+    reads = writes = 0;
 
-                        exit(0);
-                }
+    switch ((Opcode)getOpcode(instr)) {
+        case Opcode::SPECIAL:
+            switch ((SPECIAL)getFunct(instr)) {
+                case SPECIAL::SLL:
+                case SPECIAL::SRL:
+                case SPECIAL::SRA:
+                    reads = 1 << rt;
+                    break;
+                case SPECIAL::MOVZ:
+                case SPECIAL::MOVN:
+                    reads = (1 << rs) | (1 << rt) | (1 << rd); // rd is kept if the move isn't done
+                    break;
+                case SPECIAL::SYNC:
+                    return true;
+                case SPECIAL::CLZ:
+                    reads = 1 << rs;
+                    break;
+                case SPECIAL::SLLV:
+                case SPECIAL::SRLV:
+                case SPECIAL::SRAV:
+                case SPECIAL::ADDU:
+                case SPECIAL::SUBU:
+                case SPECIAL::AND:
+                case SPECIAL::OR:
+                case SPECIAL::XOR:
+                case SPECIAL::NOR:
+                case SPECIAL::SLT:
+                case SPECIAL::SLTU:
+                case SPECIAL::MAX:
+                case SPECIAL::MIN:
+                    reads = (1 << rs) | (1 << rt);
+                    break;
+                default:
+                    return false;
             }
+
+            writes = 1 << rd;
             break;
+        case Opcode::BEQ:
+        case Opcode::BNE:
         case Opcode::BEQL:
-            iBEQL(allegrex, instr);
-            break;
         case Opcode::BNEL:
-            iBNEL(allegrex, instr);
+            reads = (1 << rs) | (1 << rt);
             break;
+        case Opcode::BLEZ:
+        case Opcode::BGTZ:
         case Opcode::BLEZL:
-            iBLEZL(allegrex, instr);
-            break;
         case Opcode::BGTZL:
-            iBGTZL(allegrex, instr);
+            reads = 1 << rs;
             break;
-        case Opcode::SPECIAL2:
-            {
-                const auto funct = getFunct(instr);
+        case Opcode::REGIMM:
+            if ((REGIMM)rt >= REGIMM::BLTZAL) return false;
 
-                switch ((SPECIAL2)funct) {
-                    case SPECIAL2::HALT:
-                        iHALT(allegrex, instr);
-                        break;
-                    case SPECIAL2::MFIC:
-                        iMFIC(allegrex, instr);
-                        break;
-                    case SPECIAL2::MTIC:
-                        iMTIC(allegrex, instr);
-                        break;
-                    default:
-                        std::printf("Unhandled %s SPECIAL2 instruction 0x%02X (0x%08X) @ 0x%08X\n", allegrex->getTypeName(), funct, instr, cpc);
-
-                        exit(0);
-                }
-            }
+            reads = 1 << rs;
             break;
-        case Opcode::SPECIAL3:
-            {
-                const auto funct = getFunct(instr);
-
-                switch ((SPECIAL3)funct) {
-                    case SPECIAL3::EXT:
-                        iEXT(allegrex, instr);
-                        break;
-                    case SPECIAL3::INS:
-                        iINS(allegrex, instr);
-                        break;
-                    case SPECIAL3::BSHFL:
-                        {
-                            const auto shamt = getShamt(instr);
-
-                            switch ((BSHFL)shamt) {
-                                case BSHFL::WSBH:
-                                    iWSBH(allegrex, instr);
-                                    break;
-                                case BSHFL::WSBW:
-                                    iWSBW(allegrex, instr);
-                                    break;
-                                case BSHFL::SEB:
-                                    iSEB(allegrex, instr);
-                                    break;
-                                case BSHFL::BITREV:
-                                    iBITREV(allegrex, instr);
-                                    break;
-                                case BSHFL::SEH:
-                                    iSEH(allegrex, instr);
-                                    break;
-                                default:
-                                    std::printf("Unhandled BSHFL instruction 0x%02X (0x%08X) @ 0x%08X\n", shamt, instr, cpc);
-
-                                    exit(0);
-                            }
-                        }
-                        break;
-                    default:
-                        std::printf("Unhandled %s SPECIAL3 instruction 0x%02X (0x%08X) @ 0x%08X\n", allegrex->getTypeName(), funct, instr, cpc);
-
-                        exit(0);
-                }
-            }
+        case Opcode::J:
             break;
+        case Opcode::ADDIU:
+        case Opcode::SLTI:
+        case Opcode::SLTIU:
+        case Opcode::ANDI:
+        case Opcode::ORI:
+        case Opcode::XORI:
         case Opcode::LB:
-            iLB(allegrex, instr);
-            break;
         case Opcode::LH:
-            iLH(allegrex, instr);
-            break;
-        case Opcode::LWL:
-            iLWL(allegrex, instr);
-            break;
         case Opcode::LW:
-            iLW(allegrex, instr);
-            break;
         case Opcode::LBU:
-            iLBU(allegrex, instr);
-            break;
         case Opcode::LHU:
-            iLHU(allegrex, instr);
-            break;
-        case Opcode::LWR:
-            iLWR(allegrex, instr);
-            break;
-        case Opcode::SB:
-            iSB(allegrex, instr);
-            break;
-        case Opcode::SH:
-            iSH(allegrex, instr);
-            break;
-        case Opcode::SWL:
-            iSWL(allegrex, instr);
+            reads = 1 << rs;
+            writes = 1 << rt;
             break;
-        case Opcode::SW:
-            iSW(allegrex, instr);
+        case Opcode::LUI:
+            writes = 1 << rt;
             break;
-        case Opcode::SWR:
-            iSWR(allegrex, instr);
+        case Opcode::SPECIAL3:
+            switch ((SPECIAL3)getFunct(instr)) {
+                case SPECIAL3::EXT:
+                    reads = 1 << rs;
+                    break;
+                case SPECIAL3::INS:
+                    reads = (1 << rs) | (1 << rt);
+                    break;
+                case SPECIAL3::BSHFL:
+                    reads = 1 << rt;
+                    writes = 1 << rd;
+                    return true;
+                default:
+                    return false;
+            }
+
+            writes = 1 << rt;
             break;
-        case Opcode::CACHE:
-            iCACHE(allegrex, instr);
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Returns true if a block is a loop that can only be left through an interrupt or
+ * a change in memory. The block must branch back to its start, must not store
+ * and must not carry register values from one iteration to the next.
+ * Loads may still hit devices, this has to be checked while running the loop.
+ */
+bool isIdleLoop(const blockcache::Block *block) {
+    const auto size = block->instrs.size();
+
+    if ((size < 2) || (size > MAX_IDLE_LOOP_SIZE)) return false;
+
+    const auto branchAddr = block->addr + 4 * (u32)(size - 2);
+    const auto branchInstr = block->instrs[size - 2].instr;
+
+    if (!isBranch(branchInstr)) return false;
+
+    u32 target;
+
+    if ((Opcode)getOpcode(branchInstr) == Opcode::J) {
+        target = ((branchAddr + 4) & 0xF0000000) | (getOffset(branchInstr) << 2);
+    } else if ((Opcode)getOpcode(branchInstr) != Opcode::SPECIAL) {
+        target = branchAddr + 4 + ((i32)(i16)getImm(branchInstr) << 2);
+    } else {
+        return false;
+    }
+
+    if ((target & ((u32)memory::MemoryBase::PAddrSpace - 1)) != block->addr) return false;
+
+    u32 carried = 0, written = 0;
+
+    for (const auto &entry : block->instrs) {
+        u32 reads, writes;
+
+        if (!getIdleRegUsage(entry.instr, reads, writes)) return false;
+
+        carried |= reads & ~written;
+        written |= writes;
+    }
+
+    // R0 never changes
+    return !(carried & written & ~1U);
+}
+
+/*
+ * Returns true if an idle loop has exactly one load. No register is carried between
+ * iterations, so the load address is the same every time: if the load hits a device,
+ * the loop polls a single register that can only change when an event fires
+ */
+bool isPollLoop(const blockcache::Block *block) {
+    int loadCount = 0;
+
+    for (const auto &entry : block->instrs) {
+        switch ((Opcode)getOpcode(entry.instr)) {
+            case Opcode::LB:
+            case Opcode::LH:
+            case Opcode::LW:
+            case Opcode::LBU:
+            case Opcode::LHU:
+                loadCount++;
+                break;
+            default:
+                break;
+        }
+    }
+
+    return loadCount == 1;
+}
+
+// Returns true if a loop iteration made no device accesses, or only the one of a polling loop
+bool isIdleIteration(const blockcache::Block *block, u64 ioCount, u64 lastIOCount) {
+    const auto ioDelta = ioCount - lastIOCount;
+
+    return (ioDelta == 0) || (block->isPollLoop && (ioDelta == 1));
+}
+
+// Idle loop candidate of the uncached interpreter
+struct IdleState {
+    u32 loopAddr;
+    u64 ioCount;
+};
+
+IdleState idleStates[2]; // CPU, ME
+
+/*
+ * Checks a backward jump for an idle loop, the loop block has to be seen twice
+ * without device accesses in between (other than the polled register of a polling loop).
+ * Returns true if the core is idle
+ */
+bool checkIdleJump(Allegrex *allegrex, u32 from, u32 to) {
+    if ((from - to) >= (4 * MAX_IDLE_LOOP_SIZE)) return false;
+
+    const auto block = blockcache::getBlock(allegrex, to);
+
+    // The jump has to come from the delay slot of the loop branch
+    const auto delayAddr = block->addr + 4 * (u32)(block->instrs.size() - 1);
+
+    if (!block->isIdleLoop || ((from & ((u32)memory::MemoryBase::PAddrSpace - 1)) != delayAddr)) return false;
+
+    auto &state = idleStates[allegrex->isME()];
+
+    const auto ioCount = memory::getIOCount(allegrex->isME());
+
+    if ((state.loopAddr == to) && isIdleIteration(block, ioCount, state.ioCount)) {
+        allegrex->isIdle = true;
+
+        return true;
+    }
+
+    state.loopAddr = to;
+    state.ioCount = ioCount;
+
+    return false;
+}
+
+int getClockShift(Allegrex *allegrex) {
+    return allegrex->isME() ? CLOCK_SHIFT<Type::MediaEngine> : CLOCK_SHIFT<Type::Allegrex>;
+}
+
+bool checkIdleBlock(Allegrex *allegrex, const blockcache::Block *block, u32 pc, u64 ioCount) {
+    if (!block->isIdleLoop || (allegrex->getPC() != pc)) return false;
+
+    if (!isIdleIteration(block, memory::getIOCount(allegrex->isME()), ioCount)) return false;
+
+    allegrex->isIdle = true;
+
+    return true;
+}
+
+template<Type type>
+void doInstr(Allegrex *allegrex) {
+    const auto instr = read32<type>(cpc);
+
+    allegrex->advancePC();
+
+    // Counted before the handler runs, device accesses and COP0 Count see the current instruction
+    allegrex->cycles++;
+
+    handlers<type>[(u8)decodeID(instr)](allegrex, instr);
+}
+
+void step(Allegrex *allegrex) {
+    cpc = allegrex->getPC();
+
+    allegrex->advanceDelay();
+
+    if (allegrex->isME()) {
+        doInstr<Type::MediaEngine>(allegrex);
+    } else {
+        doInstr<Type::Allegrex>(allegrex);
+    }
+}
+
+// Interprets up to the end of a basic block, block boundaries are the same as in the block cache
+template<Type type>
+void runColdBlockType(Allegrex *allegrex, i64 maxCycles) {
+    while (true) {
+        cpc = allegrex->getPC();
+
+        const auto inDelaySlot = allegrex->isDelaySlotPending();
+
+        allegrex->advanceDelay();
+
+        doInstr<type>(allegrex);
+
+        if (inDelaySlot || !((cpc + 4) & (BLOCK_PAGE_SIZE - 1))) return;
+
+        // Leave the block if an exception was raised, a likely branch wasn't taken or the CPU halted
+        if ((allegrex->cycles >= maxCycles) || allegrex->isHalted || (allegrex->getPC() != (cpc + 4))) return;
+    }
+}
+
+void runColdBlock(Allegrex *allegrex, i64 maxCycles) {
+    if (allegrex->isME()) {
+        runColdBlockType<Type::MediaEngine>(allegrex, maxCycles);
+    } else {
+        runColdBlockType<Type::Allegrex>(allegrex, maxCycles);
+    }
+}
+
+#ifdef INTERPRETER_THREADED
+// Threaded interpreter, every handler has its own dispatch branch
+template<Type type>
+void runType(Allegrex *allegrex) {
+    static void *const labels[] = {
+#define X(name, func) &&L_##name,
+        INSTR_LIST(X)
+#undef X
+    };
+
+    allegrex->isIdle = false;
+    allegrex->cycles = 0;
+
+    u32 instr;
+    u32 lastPC = allegrex->getPC();
+
+#define DISPATCH() \
+    if ((allegrex->cycles >= scheduler::getSliceCycles(CLOCK_SHIFT<type>)) || allegrex->isHalted) return; \
+    cpc = allegrex->getPC(); \
+    if ((cpc < lastPC) && checkIdleJump(allegrex, lastPC, cpc)) return; \
+    lastPC = cpc; \
+    allegrex->advanceDelay(); \
+    instr = read32<type>(cpc); \
+    allegrex->advancePC(); \
+    allegrex->cycles++; \
+    goto *labels[(u8)decodeID(instr)];
+
+    DISPATCH();
+
+#define X(name, func) L_##name: func(allegrex, instr); DISPATCH();
+    INSTR_LIST(X)
+#undef X
+
+#undef DISPATCH
+}
+#else
+template<Type type>
+void runType(Allegrex *allegrex) {
+    allegrex->isIdle = false;
+    allegrex->cycles = 0;
+
+    u32 lastPC = allegrex->getPC();
+
+    while (allegrex->cycles < scheduler::getSliceCycles(CLOCK_SHIFT<type>)) {
+        if (allegrex->isHalted) return;
+
+        cpc = allegrex->getPC();
+
+        if ((cpc < lastPC) && checkIdleJump(allegrex, lastPC, cpc)) return;
+
+        lastPC = cpc;
+
+        allegrex->advanceDelay();
+
+        doInstr<type>(allegrex);
+    }
+}
+#endif
+
+void run(Allegrex *allegrex) {
+    if (allegrex->isME()) {
+        runType<Type::MediaEngine>(allegrex);
+    } else {
+        runType<Type::Allegrex>(allegrex);
+    }
+}
+
+// Executes an op that doesn't need the interpreter
+void doOp(Allegrex *allegrex, const ir::Op &op) {
+    switch (op.kind) {
+        case ir::OpKind::Const:
+            allegrex->set(op.reg, op.value);
             break;
-        case Opcode::LWC1:
-            iLWC(allegrex, 1, instr);
+        case ir::OpKind::Move:
+            allegrex->set(op.reg, allegrex->get(op.src));
             break;
-        case Opcode::SWC1:
-            iSWC(allegrex, 1, instr);
+        case ir::OpKind::Load:
+            switch (op.size) {
+                case 1:
+                    allegrex->set(op.reg, op.isSigned ? (u32)(i8)*op.mem : *op.mem);
+                    break;
+                case 2:
+                    {
+                        u16 data;
+                        std::memcpy(&data, op.mem, sizeof(u16));
+
+                        allegrex->set(op.reg, op.isSigned ? (u32)(i16)data : data);
+                    }
+                    break;
+                default:
+                    {
+                        u32 data;
+                        std::memcpy(&data, op.mem, sizeof(u32));
+
+                        allegrex->set(op.reg, data);
+                    }
+                    break;
+            }
             break;
-        case Opcode::SQC2:
-            iSVQ(allegrex, instr);
+        case ir::OpKind::Store:
+            {
+                const auto data = allegrex->get(op.reg);
+
+                memory::writeFixed(op.mem, &data, op.size);
+            }
             break;
         default:
-            std::printf("Unhandled %s instruction 0x%02X (0x%08X) @ 0x%08X\n", allegrex->getTypeName(), opcode, instr, cpc);
+            break;
+    }
+}
 
-            exit(0);
+/*
+ * Runs the ops of a block that is entered outside of a delay slot and runs to completion.
+ * Up to the branch, PC is only written back before interpreted ops and on exit,
+ * the delay slot state is only updated on entry and for the delay slot
+ */
+void runOps(Allegrex *allegrex, const blockcache::Block *block) {
+    const auto baseAddr = allegrex->getPC();
+    const auto size = (u32)block->ops.size();
+
+    allegrex->advanceDelay();
+
+    for (u32 i = 0; i < size; i++) {
+        const auto &op = block->ops[i];
+
+        allegrex->cycles++;
+
+        if (op.isDelaySlot) {
+            cpc = allegrex->getPC();
+
+            allegrex->advanceDelay();
+            allegrex->advancePC();
+        } else if ((op.kind == ir::OpKind::Interp) || (op.kind == ir::OpKind::Fused)) {
+            cpc = baseAddr + 4 * i;
+
+            allegrex->setPC(cpc + 4);
+        }
+
+        switch (op.kind) {
+            case ir::OpKind::Interp:
+                block->instrs[i].func(allegrex, block->instrs[i].instr);
+                break;
+            case ir::OpKind::Fused:
+                // The handler advances cpc, PC and cycles to the second instruction unless the first one left the block
+                op.fused(allegrex, block->instrs[i].instr, block->instrs[i + 1].instr);
+
+                i++;
+                break;
+            default:
+                doOp(allegrex, op);
+
+                continue;
+        }
+
+        // Leave the block if an exception was raised, a likely branch wasn't taken or the CPU halted
+        if (allegrex->isHalted || (allegrex->getPC() != (cpc + 4))) return;
     }
 
-    return 1;
+    if (!block->ops[size - 1].isDelaySlot && (block->ops[size - 1].kind != ir::OpKind::Interp)) {
+        allegrex->setPC(baseAddr + 4 * size);
+    }
 }
 
-void run(Allegrex *allegrex, i64 runCycles) {
-    allegrex->cop0.runCount(runCycles);
+// Runs a pre-decoded basic block until the core has executed maxCycles in the current slice
+void runBlock(Allegrex *allegrex, const blockcache::Block *block, i64 maxCycles) {
+    if (!allegrex->isDelaySlotPending() && ((maxCycles - allegrex->cycles) >= (i64)block->ops.size())) {
+        runOps(allegrex, block);
 
-    for (i64 i = 0; i < runCycles;) {
-        if (allegrex->isHalted) return;
+        return;
+    }
 
+    for (const auto &entry : block->instrs) {
         cpc = allegrex->getPC();
 
         allegrex->advanceDelay();
+        allegrex->advancePC();
+
+        // Counted before the handler runs, device accesses catch up to the current instruction
+        allegrex->cycles++;
+
+        entry.func(allegrex, entry.instr);
+
+        // Leave the block if an exception was raised, a likely branch wasn't taken or the CPU halted
+        if ((allegrex->cycles >= maxCycles) || allegrex->isHalted || (allegrex->getPC() != (cpc + 4))) break;
+    }
+}
+
+// Runs pre-decoded basic blocks from the block cache
+void runCached(Allegrex *allegrex) {
+    allegrex->isIdle = false;
+
+    const auto clockShift = getClockShift(allegrex);
+
+    allegrex->cycles = 0;
+
+    while (allegrex->cycles < scheduler::getSliceCycles(clockShift)) {
+        if (allegrex->isHalted) return;
+
+        const auto pc = allegrex->getPC();
+
+        const auto block = blockcache::getBlock(allegrex, pc);
+
+        const auto ioCount = memory::getIOCount(allegrex->isME());
+        const auto inDelaySlot = allegrex->isDelaySlotPending();
+
+        if (config::lockstep) lockstep::beginBlock(allegrex);
+
+        runBlock(allegrex, block, scheduler::getSliceCycles(clockShift));
+
+        if (config::lockstep) lockstep::endBlock(allegrex, block);
 
-        i += doInstr(allegrex);
+        if (!inDelaySlot && checkIdleBlock(allegrex, block, pc, ioCount)) return;
     }
 }
 
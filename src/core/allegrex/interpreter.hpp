@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include "ir.hpp"
 #include "../../common/types.hpp"
 
 namespace psp::allegrex {
@@ -13,8 +14,46 @@ struct Allegrex;
 
 }
 
+namespace psp::allegrex::blockcache {
+
+struct Block;
+
+}
+
 namespace psp::allegrex::interpreter {
 
-void run(Allegrex *allegrex, i64 runCycles);
+// Instruction handler
+using InstrFunc = void (*)(Allegrex *, u32);
+
+extern thread_local u32 cpc; // Current program counter
+
+InstrFunc decode(Allegrex *allegrex, u32 instr);
+
+// Returns the fused handler of an instruction pair, NULL if the pair isn't fused
+ir::FusedFunc getFused(Allegrex *allegrex, u32 instr1, u32 instr2);
+
+bool isBranch(u32 instr);
+
+bool isIdleLoop(const blockcache::Block *block);
+bool isPollLoop(const blockcache::Block *block);
+
+// Marks the core as idle if block ran one full iteration of an idle loop from pc without device accesses
+// or, for polling loops, with a single access to the polled register
+bool checkIdleBlock(Allegrex *allegrex, const blockcache::Block *block, u32 pc, u64 ioCount);
+
+// Executes one instruction, reference for the other engines
+void step(Allegrex *allegrex);
+
+// Interprets the basic block at PC without decoding it into the block cache, stops early at maxCycles
+void runColdBlock(Allegrex *allegrex, i64 maxCycles);
+
+// Engines run until the end of the current scheduler slice
+void run(Allegrex *allegrex);
+void runCached(Allegrex *allegrex);
+
+// Returns the clock divider of a core as a shift of the CPU clock
+int getClockShift(Allegrex *allegrex);
+
+void runBlock(Allegrex *allegrex, const blockcache::Block *block, i64 maxCycles);
 
 }
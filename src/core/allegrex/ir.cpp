@@ -0,0 +1,567 @@
+/*
+ * ChiSP is a PlayStation Portable emulator written in C++.
+ * Copyright (C) 2023  noumidev
+ */
+
+#include "ir.hpp"
+
+#include <bit>
+#include <vector>
+
+#include "allegrex.hpp"
+#include "blockcache.hpp"
+#include "interpreter.hpp"
+#include "opcodes.hpp"
+
+#include "../memory.hpp"
+
+namespace psp::allegrex::ir {
+
+using interpreter::Opcode;
+using interpreter::SPECIAL;
+using interpreter::SPECIAL3;
+using interpreter::BSHFL;
+using interpreter::Reg;
+
+using interpreter::getOpcode;
+using interpreter::getFunct;
+using interpreter::getShamt;
+using interpreter::getImm;
+using interpreter::getRd;
+using interpreter::getRs;
+using interpreter::getRt;
+
+constexpr int NUM_REGS = 34; // 32 GPRs, LO, HI
+
+/*
+ * Returns true if instr only reads and writes GPRs and can't raise exceptions.
+ * dst is the written register, reads the mask of read registers
+ */
+bool decodeALU(u32 instr, int &dst, u64 &reads) {
+    const auto rd = getRd(instr);
+    const auto rs = getRs(instr);
+    const auto rt = getRt(instr);
+
+    switch ((Opcode)getOpcode(instr)) {
+        case Opcode::SPECIAL:
+            dst = rd;
+
+            switch ((SPECIAL)getFunct(instr)) {
+                case SPECIAL::SLL:
+                case SPECIAL::SRA:
+                    reads = 1ULL << rt;
+                    return true;
+                case SPECIAL::SRL:
+                    reads = 1ULL << rt;
+                    return rs <= 1; // SRL, ROTR
+                case SPECIAL::SRLV:
+                    reads = (1ULL << rs) | (1ULL << rt);
+                    return getShamt(instr) <= 1; // SRLV, ROTRV
+                case SPECIAL::MOVZ:
+                case SPECIAL::MOVN:
+                    reads = (1ULL << rs) | (1ULL << rt) | (1ULL << rd);
+                    return true;
+                case SPECIAL::MFHI:
+                    reads = 1ULL << Reg::HI;
+                    return true;
+                case SPECIAL::MFLO:
+                    reads = 1ULL << Reg::LO;
+                    return true;
+                case SPECIAL::CLZ:
+                    reads = 1ULL << rs;
+                    return true;
+                case SPECIAL::SLLV:
+                case SPECIAL::SRAV:
+                case SPECIAL::ADDU:
+                case SPECIAL::SUBU:
+                case SPECIAL::AND:
+                case SPECIAL::OR:
+                case SPECIAL::XOR:
+                case SPECIAL::NOR:
+                case SPECIAL::SLT:
+                case SPECIAL::SLTU:
+                case SPECIAL::MAX:
+                case SPECIAL::MIN:
+                    reads = (1ULL << rs) | (1ULL << rt);
+                    return true;
+                default:
+                    return false;
+            }
+        case Opcode::ADDIU:
+        case Opcode::SLTI:
+        case Opcode::SLTIU:
+        case Opcode::ANDI:
+        case Opcode::ORI:
+        case Opcode::XORI:
+            dst = rt;
+            reads = 1ULL << rs;
+            return true;
+        case Opcode::LUI:
+            dst = rt;
+            reads = 0;
+            return true;
+        case Opcode::SPECIAL3:
+            switch ((SPECIAL3)getFunct(instr)) {
+                case SPECIAL3::EXT:
+                    dst = rt;
+                    reads = 1ULL << rs;
+                    return (getShamt(instr) + rd + 1) <= 32;
+                case SPECIAL3::INS:
+                    dst = rt;
+                    reads = (1ULL << rs) | (1ULL << rt);
+                    return (rd >= getShamt(instr));
+                case SPECIAL3::BSHFL:
+                    switch ((BSHFL)getShamt(instr)) {
+                        case BSHFL::WSBH:
+                        case BSHFL::WSBW:
+                        case BSHFL::SEB:
+                        case BSHFL::BITREV:
+                        case BSHFL::SEH:
+                            dst = rd;
+                            reads = 1ULL << rt;
+                            return true;
+                        default:
+                            return false;
+                    }
+                default:
+                    return false;
+            }
+        default:
+            return false;
+    }
+}
+
+// Evaluates an instruction accepted by decodeALU, returns false if it can't be folded
+bool fold(u32 instr, u32 s, u32 t, u32 &result) {
+    const auto shamt = getShamt(instr);
+    const auto imm = getImm(instr);
+    const auto simm = (u32)(i16)imm;
+
+    switch ((Opcode)getOpcode(instr)) {
+        case Opcode::SPECIAL:
+            switch ((SPECIAL)getFunct(instr)) {
+                case SPECIAL::SLL : result = t << shamt; return true;
+                case SPECIAL::SRL : result = getRs(instr) ? std::rotr(t, shamt) : (t >> shamt); return true;
+                case SPECIAL::SRA : result = (u32)((i32)t >> shamt); return true;
+                case SPECIAL::SLLV: result = t << (s & 0x1F); return true;
+                case SPECIAL::SRLV: result = shamt ? std::rotr(t, s & 0x1F) : (t >> (s & 0x1F)); return true;
+                case SPECIAL::SRAV: result = (u32)((i32)t >> (s & 0x1F)); return true;
+                case SPECIAL::CLZ : result = std::countl_zero(s); return true;
+                case SPECIAL::ADDU: result = s + t; return true;
+                case SPECIAL::SUBU: result = s - t; return true;
+                case SPECIAL::AND : result = s & t; return true;
+                case SPECIAL::OR  : result = s | t; return true;
+                case SPECIAL::XOR : result = s ^ t; return true;
+                case SPECIAL::NOR : result = ~(s | t); return true;
+                case SPECIAL::SLT : result = (i32)s < (i32)t; return true;
+                case SPECIAL::SLTU: result = s < t; return true;
+                case SPECIAL::MAX : result = ((i32)s > (i32)t) ? s : t; return true;
+                case SPECIAL::MIN : result = ((i32)s < (i32)t) ? s : t; return true;
+                default:
+                    return false; // MOVZ/MOVN also read rd, MFHI/MFLO are moves
+            }
+        case Opcode::ADDIU: result = s + simm; return true;
+        case Opcode::SLTI : result = (i32)s < (i32)simm; return true;
+        case Opcode::SLTIU: result = s < simm; return true;
+        case Opcode::ANDI : result = s & imm; return true;
+        case Opcode::ORI  : result = s | imm; return true;
+        case Opcode::XORI : result = s ^ imm; return true;
+        case Opcode::LUI  : result = imm << 16; return true;
+        case Opcode::SPECIAL3:
+            switch ((SPECIAL3)getFunct(instr)) {
+                case SPECIAL3::EXT:
+                    result = (s >> shamt) & (0xFFFFFFFFu >> (31 - getRd(instr)));
+                    return true;
+                case SPECIAL3::INS:
+                    {
+                        const auto mask = 0xFFFFFFFFu >> (32 - ((getRd(instr) + 1) - shamt));
+
+                        result = (t & ~(mask << shamt)) | ((s & mask) << shamt);
+                    }
+                    return true;
+                default:
+                    switch ((BSHFL)shamt) {
+                        case BSHFL::WSBH  : result = ((t & 0xFF) << 8) | ((t & 0xFF00) >> 8) | ((t & 0xFF0000) << 8) | ((t & 0xFF000000) >> 8); return true;
+                        case BSHFL::WSBW  : result = (t >> 24) | (t << 24) | ((t & 0xFF0000) >> 8) | ((t & 0xFF00) << 8); return true;
+                        case BSHFL::SEB   : result = (u32)(i8)t; return true;
+                        case BSHFL::BITREV:
+                            result = 0;
+
+                            for (int i = 0; i < 32; i++) {
+                                if (t & (1U << i)) result |= 1U << (31 - i);
+                            }
+                            return true;
+                        default: result = (u32)(i16)t; return true;
+                    }
+            }
+        default:
+            return false;
+    }
+}
+
+// Returns the register copied by instr, -1 if instr isn't a register move
+int getMoveSource(u32 instr) {
+    const auto rs = getRs(instr);
+    const auto rt = getRt(instr);
+
+    switch ((Opcode)getOpcode(instr)) {
+        case Opcode::SPECIAL:
+            switch ((SPECIAL)getFunct(instr)) {
+                case SPECIAL::SLL:
+                case SPECIAL::SRL:
+                case SPECIAL::SRA:
+                    return getShamt(instr) ? -1 : rt;
+                case SPECIAL::MFHI:
+                    return Reg::HI;
+                case SPECIAL::MFLO:
+                    return Reg::LO;
+                case SPECIAL::ADDU:
+                case SPECIAL::OR:
+                case SPECIAL::XOR:
+                    if (rt == Reg::R0) return rs;
+                    if (rs == Reg::R0) return rt;
+
+                    return -1;
+                case SPECIAL::SUBU:
+                    return (rt == Reg::R0) ? rs : -1;
+                default:
+                    return -1;
+            }
+        case Opcode::ADDIU:
+        case Opcode::ORI:
+        case Opcode::XORI:
+            return getImm(instr) ? -1 : rs;
+        default:
+            return -1;
+    }
+}
+
+// Returns the access size of a GPR load/store, 0 for other instructions
+u32 getAccessSize(u32 instr, bool &isStore, bool &isSigned) {
+    isStore = isSigned = false;
+
+    switch ((Opcode)getOpcode(instr)) {
+        case Opcode::LB : isSigned = true; return 1;
+        case Opcode::LBU: return 1;
+        case Opcode::LH : isSigned = true; return 2;
+        case Opcode::LHU: return 2;
+        case Opcode::LW : return 4;
+        case Opcode::SB : isStore = true; return 1;
+        case Opcode::SH : isStore = true; return 2;
+        case Opcode::SW : isStore = true; return 4;
+        default:
+            return 0;
+    }
+}
+
+// Result of a load of size bytes from memory holding the low bytes of data
+u32 extend(u32 data, u32 size, bool isSigned) {
+    switch (size) {
+        case 1 : return isSigned ? (u32)(i8)data : (u8)data;
+        case 2 : return isSigned ? (u32)(i16)data : (u16)data;
+        default: return data;
+    }
+}
+
+struct Value {
+    bool isConst;
+    u32 constant;
+};
+
+// RAM at mem holds the low size bytes of a value
+struct MemValue {
+    u8 *mem;
+    u32 size;
+    u32 value;
+
+    bool isLoad;   // Recorded by a load, the value is the extended load result
+    bool isSigned; // Extension of the load
+};
+
+// Store that is dead if its bytes are overwritten before they're read
+struct PendingStore {
+    u8 *mem;
+    u32 size;
+    u32 idx;
+};
+
+struct Translator {
+    bool isME;
+
+    blockcache::Block *block;
+
+    std::vector<Value> values;
+
+    u32 regValues[NUM_REGS]; // Value held by each register
+
+    std::vector<MemValue> memValues;
+    std::vector<PendingStore> pendingStores;
+
+    u32 newValue(bool isConst, u32 constant) {
+        values.push_back(Value{isConst, constant});
+
+        return (u32)(values.size() - 1);
+    }
+
+    const Value &get(int reg) {
+        return values[regValues[reg]];
+    }
+
+    void define(int reg, u32 value) {
+        if (reg != Reg::R0) regValues[reg] = value;
+    }
+
+    // Returns a register holding value, -1 if there is none
+    int findReg(u32 value) {
+        for (int i = 1; i < NUM_REGS; i++) {
+            if (regValues[i] == value) return i;
+        }
+
+        return -1;
+    }
+
+    // Registers written by an unknown instruction
+    void forgetRegs() {
+        for (int i = 1; i < NUM_REGS; i++) regValues[i] = newValue(false, 0);
+    }
+
+    // Unknown instructions can write memory or leave the block
+    void forgetMemory() {
+        memValues.clear();
+        pendingStores.clear();
+    }
+
+    bool overlaps(const u8 *memA, u32 sizeA, const u8 *memB, u32 sizeB) {
+        return (memA < (memB + sizeB)) && (memB < (memA + sizeA));
+    }
+
+    void dropMemValues(const u8 *mem, u32 size) {
+        std::erase_if(memValues, [&](const MemValue &memValue) {return overlaps(memValue.mem, memValue.size, mem, size);});
+    }
+
+    void dropPendingStores(const u8 *mem, u32 size) {
+        std::erase_if(pendingStores, [&](const PendingStore &store) {return overlaps(store.mem, store.size, mem, size);});
+    }
+
+    void translateALU(Op &op, u32 instr, int dst, u64 reads) {
+        // Writes to R0 are dropped
+        if (dst == Reg::R0) {
+            op.kind = OpKind::Nop;
+
+            return;
+        }
+
+        bool isConst = true;
+
+        for (int i = 0; i < NUM_REGS; i++) {
+            if ((reads & (1ULL << i)) && !get(i).isConst) isConst = false;
+        }
+
+        u32 result;
+
+        if (isConst && fold(instr, get(getRs(instr)).constant, get(getRt(instr)).constant, result)) {
+            op.kind = OpKind::Const;
+            op.reg = dst;
+            op.value = result;
+
+            define(dst, newValue(true, result));
+
+            return;
+        }
+
+        if (const auto src = getMoveSource(instr); src >= 0) {
+            op.kind = OpKind::Move;
+            op.reg = dst;
+            op.src = src;
+
+            define(dst, regValues[src]);
+
+            return;
+        }
+
+        define(dst, newValue(false, 0));
+    }
+
+    void translateLoad(Op &op, u32 instr, u8 *mem, u32 size, bool isSigned) {
+        const auto rt = getRt(instr);
+
+        dropPendingStores(mem, size);
+
+        // RAM loads to R0 have no effect
+        if (rt == Reg::R0) {
+            op.kind = OpKind::Nop;
+
+            return;
+        }
+
+        for (const auto &memValue : memValues) {
+            if ((memValue.mem != mem) || (memValue.size != size)) continue;
+
+            const auto &value = values[memValue.value];
+
+            if (value.isConst) {
+                op.kind = OpKind::Const;
+                op.reg = rt;
+                op.value = extend(value.constant, size, isSigned);
+
+                define(rt, newValue(true, op.value));
+
+                return;
+            }
+
+            // The register has to hold the exact load result
+            const auto src = findReg(memValue.value);
+
+            if ((src >= 0) && ((size == 4) || (memValue.isLoad && (memValue.isSigned == isSigned)))) {
+                op.kind = OpKind::Move;
+                op.reg = rt;
+                op.src = src;
+
+                define(rt, memValue.value);
+
+                return;
+            }
+
+            break;
+        }
+
+        op.kind = OpKind::Load;
+        op.reg = rt;
+        op.size = size;
+        op.isSigned = isSigned;
+        op.mem = mem;
+
+        const auto value = newValue(false, 0);
+
+        dropMemValues(mem, size);
+
+        memValues.push_back(MemValue{mem, size, value, true, isSigned});
+
+        define(rt, value);
+    }
+
+    void translateStore(Op &op, u32 idx, u32 instr, u8 *mem, u32 size) {
+        const auto rt = getRt(instr);
+
+        const auto value = regValues[rt];
+
+        // RAM already holds the value
+        for (const auto &memValue : memValues) {
+            if ((memValue.mem == mem) && (memValue.size == size) && ((memValue.value == value) || (values[memValue.value].isConst && get(rt).isConst && !((values[memValue.value].constant ^ get(rt).constant) & (0xFFFFFFFFu >> (32 - 8 * size)))))) {
+                op.kind = OpKind::Nop;
+
+                return;
+            }
+        }
+
+        // A previous store to the same bytes is dead
+        for (const auto &store : pendingStores) {
+            if ((store.mem == mem) && (store.size == size)) {
+                block->ops[store.idx].kind = OpKind::Nop;
+
+                break;
+            }
+        }
+
+        dropPendingStores(mem, size);
+        dropMemValues(mem, size);
+
+        op.kind = OpKind::Store;
+        op.reg = rt;
+        op.size = size;
+        op.mem = mem;
+
+        pendingStores.push_back(PendingStore{mem, size, idx});
+        memValues.push_back(MemValue{mem, size, value, false, false});
+    }
+
+    void translate(u32 idx) {
+        auto &op = block->ops[idx];
+
+        const auto instr = block->instrs[idx].instr;
+
+        op.kind = OpKind::Interp;
+        op.isDelaySlot = (idx > 0) && interpreter::isBranch(block->instrs[idx - 1].instr);
+
+        int dst;
+        u64 reads;
+
+        if (!interpreter::isBranch(instr) && decodeALU(instr, dst, reads)) {
+            translateALU(op, instr, dst, reads);
+
+            return;
+        }
+
+        bool isStore, isSigned;
+
+        const auto size = getAccessSize(instr, isStore, isSigned);
+
+        if (size && get(getRs(instr)).isConst) {
+            const auto addr = get(getRs(instr)).constant + (u32)(i16)getImm(instr);
+
+            // Misaligned accesses are left to the interpreter
+            if (!(addr & (size - 1))) {
+                if (const auto mem = memory::getFixedPointer(isME, addr)) {
+                    if (isStore) {
+                        translateStore(op, idx, instr, mem, size);
+                    } else {
+                        translateLoad(op, instr, mem, size, isSigned);
+                    }
+
+                    return;
+                }
+
+                op.isDevice = memory::isFixedDevice(isME, addr);
+            }
+        }
+
+        // Interpreted loads/stores can touch any memory, other instructions are unknown
+        if (size) {
+            forgetMemory();
+
+            if (!isStore) define(getRt(instr), newValue(false, 0));
+
+            return;
+        }
+
+        forgetRegs();
+        forgetMemory();
+    }
+};
+
+void translate(Allegrex *allegrex, blockcache::Block *block) {
+    Translator translator;
+
+    translator.isME = allegrex->isME();
+    translator.block = block;
+
+    // Register values are unknown on entry, R0 is always 0
+    translator.values.push_back(Value{true, 0});
+
+    translator.regValues[Reg::R0] = 0;
+
+    for (int i = 1; i < NUM_REGS; i++) translator.regValues[i] = translator.newValue(false, 0);
+
+    block->ops.assign(block->instrs.size(), Op{});
+
+    for (u32 i = 0; i < block->instrs.size(); i++) translator.translate(i);
+
+    // The second op of a pair keeps its kind, it is still used by the JIT
+    for (u32 i = 0; (i + 1) < block->ops.size(); i++) {
+        auto &op = block->ops[i];
+
+        const auto nextKind = block->ops[i + 1].kind;
+
+        if ((op.kind != OpKind::Interp) || ((nextKind != OpKind::Interp) && (nextKind != OpKind::Move))) continue;
+
+        op.fused = interpreter::getFused(allegrex, block->instrs[i].instr, block->instrs[i + 1].instr);
+
+        if (op.fused == NULL) continue;
+
+        op.kind = OpKind::Fused;
+
+        i++;
+    }
+}
+
+}
@@ -0,0 +1,67 @@
+/*
+ * ChiSP is a PlayStation Portable emulator written in C++.
+ * Copyright (C) 2023  noumidev
+ */
+
+#pragma once
+
+#include "../../common/types.hpp"
+
+namespace psp::allegrex {
+
+struct Allegrex;
+
+}
+
+namespace psp::allegrex::blockcache {
+
+struct Block;
+
+}
+
+/*
+ * Block IR, one op per guest instruction.
+ *
+ * Translation gives every GPR write a new value number and tracks constant values and known RAM contents
+ * through the block. Ops with known results become constant loads, writes to R0 and redundant RAM accesses
+ * are dropped, and loads/stores with constant addresses have their memory region resolved.
+ * Common pairs of interpreted instructions are fused into one op that runs both handlers with a single dispatch.
+ * Ops are only valid if the block is entered outside of a delay slot and runs to completion.
+ */
+namespace psp::allegrex::ir {
+
+enum class OpKind : u8 {
+    Nop,    // No effect
+    Const,  // GPR = value
+    Move,   // GPR = GPR
+    Load,   // GPR = RAM at a resolved host pointer
+    Store,  // RAM at a resolved host pointer = GPR
+    Interp, // Runs the interpreter handler
+    Fused,  // Runs the fused handler of this instruction and the next one, the next op is skipped
+};
+
+// Handler of a fused instruction pair
+using FusedFunc = void (*)(Allegrex *, u32, u32);
+
+struct Op {
+    OpKind kind;
+
+    u8 reg;  // Destination of Const/Move/Load, source of Store
+    u8 src;  // Source of Move
+    u8 size; // Load/Store size in bytes
+
+    bool isSigned;    // Load is sign-extended
+    bool isDevice;    // Interpreted load/store to a constant device address
+    bool isDelaySlot; // Op is in the delay slot of the previous op, PC and delay slot state have to be updated
+
+    u32 value; // Const value
+
+    u8 *mem; // Load/Store host pointer
+
+    FusedFunc fused; // Fused handler
+};
+
+// Builds the ops of a decoded block, ops are parallel to block->instrs
+void translate(Allegrex *allegrex, blockcache::Block *block);
+
+}
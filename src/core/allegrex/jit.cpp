@@ -0,0 +1,1067 @@
+/*
+ * ChiSP is a PlayStation Portable emulator written in C++.
+ * Copyright (C) 2023  noumidev
+ */
+
+#include "jit.hpp"
+
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+#include "allegrex.hpp"
+#include "blockcache.hpp"
+#include "interpreter.hpp"
+#include "lockstep.hpp"
+#include "opcodes.hpp"
+
+#include "../config.hpp"
+#include "../memory.hpp"
+#include "../scheduler.hpp"
+
+#if defined(__x86_64__) && defined(__unix__)
+#define JIT_X64
+
+#include <sys/mman.h>
+
+#include "x64emitter.hpp"
+#endif
+
+#if defined(JIT_X64) && defined(__linux__)
+#define JIT_FASTMEM
+
+#include <csignal>
+#include <ucontext.h>
+#endif
+
+namespace psp::allegrex::jit {
+
+bool isAvailable = false; // Set if init() succeeded
+
+#ifdef JIT_X64
+
+using blockcache::Block;
+
+using interpreter::Opcode;
+using interpreter::SPECIAL;
+using interpreter::SPECIAL2;
+using interpreter::SPECIAL3;
+using interpreter::BSHFL;
+using interpreter::REGIMM;
+using interpreter::Reg;
+
+using interpreter::getOpcode;
+using interpreter::getFunct;
+using interpreter::getShamt;
+using interpreter::getImm;
+using interpreter::getOffset;
+using interpreter::getRd;
+using interpreter::getRs;
+using interpreter::getRt;
+
+constexpr u64 CODE_BUFFER_SIZE = 32 << 20;
+
+// Upper bounds of emitted code size
+constexpr u64 MAX_INSTR_SIZE  = 256;
+constexpr u64 MAX_BLOCK_EXTRA = 64;
+
+// Per-core code buffer
+struct CodeBuffer {
+    u8 *base;
+    u64 used;
+
+    // Maps faulting host instructions to their slow path, only touched by the core's thread
+    std::unordered_map<u64, u64> fastmemSites;
+};
+
+CodeBuffer codeBuffers[2]; // CPU, ME
+
+constexpr u64 NO_JUMP = ~(u64)0;
+
+// Out-of-line fallback for a fastmem load/store
+struct SlowPath {
+    u32 idx; // Instruction index in the block
+
+    u64 alignJump; // Misalignment check, NO_JUMP for byte accesses
+    u64 faultPos;  // Host load/store that faults on device pages
+    u64 resumePos;
+    u64 stubPos;
+};
+
+#ifdef JIT_FASTMEM
+struct sigaction oldSegvAction;
+#endif
+
+/*
+ * Translates a basic block to host code.
+ *
+ * RBX holds the Allegrex pointer. PC/NPC are only written back when they're observable,
+ * i.e. before calling an interpreter handler and on block exit.
+ * Compiled blocks are never entered from a delay slot, the dispatcher interprets those.
+ */
+struct Compiler {
+    Emitter e;
+
+    Allegrex *allegrex;
+
+    const Block *block;
+
+    u32 baseAddr;
+    u32 statePC; // Value of PC in the CPU state (NPC is always PC + 4)
+
+    u8 *fastmemBase; // NULL if fastmem is disabled
+
+    std::vector<SlowPath> slowPaths;
+
+    i32 getRegOffset(int idx) {
+        return (i32)((u8 *)&allegrex->regs[idx] - (u8 *)allegrex);
+    }
+
+    i32 getBlockCyclesOffset() {
+        return (i32)((u8 *)&allegrex->blockCycles - (u8 *)allegrex);
+    }
+
+    i32 getHaltedOffset() {
+        return (i32)((u8 *)&allegrex->isHalted - (u8 *)allegrex);
+    }
+
+    i32 getPCOffset() {
+        return (i32)((u8 *)&allegrex->pc - (u8 *)allegrex);
+    }
+
+    i32 getNPCOffset() {
+        return (i32)((u8 *)&allegrex->npc - (u8 *)allegrex);
+    }
+
+    i32 getDelaySlotOffset(int idx) {
+        return (i32)((u8 *)&allegrex->inDelaySlot[idx] - (u8 *)allegrex);
+    }
+
+    void loadReg(HostReg dst, int idx) {
+        if (idx == Reg::R0) {
+            e.movImm(dst, 0); // Doesn't modify flags
+        } else {
+            e.movLoad(dst, getRegOffset(idx));
+        }
+    }
+
+    void storeReg(int idx, HostReg src) {
+        if (idx != Reg::R0) e.movStore(getRegOffset(idx), src);
+    }
+
+    void setPC(u32 addr) {
+        e.movStoreImm(getPCOffset(), addr);
+    }
+
+    void setNPC(u32 addr) {
+        e.movStoreImm(getNPCOffset(), addr);
+    }
+
+    // Writes back PC/NPC if they're out of date
+    void syncPC(u32 addr) {
+        if (statePC == addr) return;
+
+        setPC(addr);
+        setNPC(addr + 4);
+
+        statePC = addr;
+    }
+
+    // Returns the number of executed instructions
+    void exitBlock(u32 count) {
+        e.movImm(RAX, count);
+        e.pop(RBX);
+        e.ret();
+    }
+
+    void callHandler(const blockcache::Instr &entry, u32 addr) {
+        // Some handlers log the current PC. Blocks are compiled on the thread that runs them, so this is that thread's copy
+        e.movImm64(RAX, (u64)&interpreter::cpc);
+        e.movStoreImmRAX(addr);
+
+        // COP0 reads and writes Count at the current instruction, cycles is only updated at the end of the block
+        if ((Opcode)getOpcode(entry.instr) == Opcode::COP0) {
+            e.movStoreImm(getBlockCyclesOffset(), (addr - baseAddr) / 4 + 1);
+        }
+
+        e.mov64(RDI, RBX);
+        e.movImm(RSI, entry.instr);
+        e.movImm64(RAX, (u64)entry.func);
+        e.call(RAX);
+    }
+
+    // Translates ops resolved by the optimizer, returns false for interpreted ops and stores
+    bool compileOp(u32 idx) {
+        const auto &op = block->ops[idx];
+
+        switch (op.kind) {
+            case ir::OpKind::Nop:
+                return true;
+            case ir::OpKind::Const:
+                e.movImm(RAX, op.value);
+
+                storeReg(op.reg, RAX);
+                return true;
+            case ir::OpKind::Move:
+                loadReg(RAX, op.src);
+
+                storeReg(op.reg, RAX);
+                return true;
+            case ir::OpKind::Load:
+                e.movImm64(RDX, (u64)op.mem);
+                e.movImm(RCX, 0);
+                e.movLoadIdx(RAX, op.size, op.isSigned);
+
+                storeReg(op.reg, RAX);
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Returns true if the instruction was translated
+    bool compileALU(u32 instr) {
+        const auto rd = getRd(instr);
+        const auto rs = getRs(instr);
+        const auto rt = getRt(instr);
+        const auto shamt = getShamt(instr);
+        const auto imm = getImm(instr);
+        const auto simm = (u32)(i16)imm;
+
+        switch ((Opcode)getOpcode(instr)) {
+            case Opcode::SPECIAL:
+                switch ((SPECIAL)getFunct(instr)) {
+                    case SPECIAL::SLL:
+                    case SPECIAL::SRL:
+                    case SPECIAL::SRA:
+                        {
+                            ShiftOp op;
+                            switch ((SPECIAL)getFunct(instr)) {
+                                case SPECIAL::SLL: op = SHIFT_SHL; break;
+                                case SPECIAL::SRA: op = SHIFT_SAR; break;
+                                default:
+                                    if (rs > 1) return false;
+
+                                    op = (rs == 1) ? SHIFT_ROR : SHIFT_SHR;
+                                    break;
+                            }
+
+                            if (rd == Reg::R0) return true;
+
+                            loadReg(RAX, rt);
+
+                            if (shamt) e.shiftImm(op, RAX, shamt);
+
+                            storeReg(rd, RAX);
+                        }
+                        return true;
+                    case SPECIAL::SLLV:
+                    case SPECIAL::SRLV:
+                    case SPECIAL::SRAV:
+                        {
+                            ShiftOp op;
+                            switch ((SPECIAL)getFunct(instr)) {
+                                case SPECIAL::SLLV: op = SHIFT_SHL; break;
+                                case SPECIAL::SRAV: op = SHIFT_SAR; break;
+                                default:
+                                    if (shamt > 1) return false;
+
+                                    op = (shamt == 1) ? SHIFT_ROR : SHIFT_SHR;
+                                    break;
+                            }
+
+                            if (rd == Reg::R0) return true;
+
+                            // x86 masks the shift amount with 0x1F
+                            loadReg(RCX, rs);
+                            loadReg(RAX, rt);
+                            e.shiftCL(op, RAX);
+
+                            storeReg(rd, RAX);
+                        }
+                        return true;
+                    case SPECIAL::MOVZ:
+                    case SPECIAL::MOVN:
+                        if (rd == Reg::R0) return true;
+
+                        loadReg(RAX, rd);
+                        loadReg(RCX, rs);
+                        loadReg(RDX, rt);
+                        e.test(RDX, RDX);
+                        e.cmov(((SPECIAL)getFunct(instr) == SPECIAL::MOVZ) ? CC_E : CC_NE, RAX, RCX);
+
+                        storeReg(rd, RAX);
+                        return true;
+                    case SPECIAL::MFHI:
+                    case SPECIAL::MFLO:
+                        if (rd == Reg::R0) return true;
+
+                        loadReg(RAX, ((SPECIAL)getFunct(instr) == SPECIAL::MFHI) ? Reg::HI : Reg::LO);
+
+                        storeReg(rd, RAX);
+                        return true;
+                    case SPECIAL::CLZ:
+                        if (rd == Reg::R0) return true;
+
+                        // BSR leaves the destination undefined for 0 inputs
+                        loadReg(RCX, rs);
+                        e.bsr(RDX, RCX);
+                        e.movImm(RAX, 0xFFFFFFFF);
+                        e.cmov(CC_E, RDX, RAX);
+                        e.movImm(RAX, 31);
+                        e.alu(ALU_SUB, RAX, RDX);
+
+                        storeReg(rd, RAX);
+                        return true;
+                    case SPECIAL::MULTU:
+                        loadReg(RAX, rs);
+                        loadReg(RCX, rt);
+                        e.mul(RCX);
+
+                        storeReg(Reg::LO, RAX);
+                        storeReg(Reg::HI, RDX);
+                        return true;
+                    case SPECIAL::ADDU:
+                    case SPECIAL::SUB:
+                    case SPECIAL::SUBU:
+                    case SPECIAL::AND:
+                    case SPECIAL::OR:
+                    case SPECIAL::XOR:
+                    case SPECIAL::NOR:
+                        {
+                            ALUOp op;
+                            switch ((SPECIAL)getFunct(instr)) {
+                                case SPECIAL::ADDU: op = ALU_ADD; break;
+                                case SPECIAL::AND : op = ALU_AND; break;
+                                case SPECIAL::XOR : op = ALU_XOR; break;
+                                case SPECIAL::OR  :
+                                case SPECIAL::NOR : op = ALU_OR ; break;
+                                default: op = ALU_SUB; break; // SUB doesn't check for overflows
+                            }
+
+                            if (rd == Reg::R0) return true;
+
+                            loadReg(RAX, rs);
+                            loadReg(RCX, rt);
+                            e.alu(op, RAX, RCX);
+
+                            if ((SPECIAL)getFunct(instr) == SPECIAL::NOR) e.notReg(RAX);
+
+                            storeReg(rd, RAX);
+                        }
+                        return true;
+                    case SPECIAL::SLT:
+                    case SPECIAL::SLTU:
+                        if (rd == Reg::R0) return true;
+
+                        loadReg(RAX, rs);
+                        loadReg(RCX, rt);
+                        e.alu(ALU_CMP, RAX, RCX);
+                        e.setcc(((SPECIAL)getFunct(instr) == SPECIAL::SLT) ? CC_L : CC_B, RAX);
+                        e.movzx8(RAX, RAX);
+
+                        storeReg(rd, RAX);
+                        return true;
+                    case SPECIAL::MAX:
+                    case SPECIAL::MIN:
+                        if (rd == Reg::R0) return true;
+
+                        loadReg(RAX, rs);
+                        loadReg(RCX, rt);
+                        e.alu(ALU_CMP, RAX, RCX);
+                        e.cmov(((SPECIAL)getFunct(instr) == SPECIAL::MAX) ? CC_LE : CC_GE, RAX, RCX);
+
+                        storeReg(rd, RAX);
+                        return true;
+                    default:
+                        return false;
+                }
+            case Opcode::ADDIU:
+            case Opcode::ANDI:
+            case Opcode::ORI:
+            case Opcode::XORI:
+                if (rt == Reg::R0) return true;
+
+                loadReg(RAX, rs);
+
+                switch ((Opcode)getOpcode(instr)) {
+                    case Opcode::ADDIU: e.aluImm(ALU_ADD, RAX, simm); break;
+                    case Opcode::ANDI : e.aluImm(ALU_AND, RAX, imm); break;
+                    case Opcode::ORI  : e.aluImm(ALU_OR , RAX, imm); break;
+                    default: e.aluImm(ALU_XOR, RAX, imm); break;
+                }
+
+                storeReg(rt, RAX);
+                return true;
+            case Opcode::SLTI:
+            case Opcode::SLTIU:
+                if (rt == Reg::R0) return true;
+
+                loadReg(RAX, rs);
+                e.aluImm(ALU_CMP, RAX, simm);
+                e.setcc(((Opcode)getOpcode(instr) == Opcode::SLTI) ? CC_L : CC_B, RAX);
+                e.movzx8(RAX, RAX);
+
+                storeReg(rt, RAX);
+                return true;
+            case Opcode::LUI:
+                if (rt == Reg::R0) return true;
+
+                e.movImm(RAX, imm << 16);
+
+                storeReg(rt, RAX);
+                return true;
+            case Opcode::SPECIAL3:
+                switch ((SPECIAL3)getFunct(instr)) {
+                    case SPECIAL3::EXT:
+                        {
+                            const auto pos  = shamt;
+                            const auto size = rd + 1;
+
+                            if ((pos + size) > 32) return false;
+
+                            if (rt == Reg::R0) return true;
+
+                            loadReg(RAX, rs);
+
+                            if (pos) e.shiftImm(SHIFT_SHR, RAX, pos);
+                            if (size < 32) e.aluImm(ALU_AND, RAX, 0xFFFFFFFFu >> (32 - size));
+
+                            storeReg(rt, RAX);
+                        }
+                        return true;
+                    case SPECIAL3::INS:
+                        {
+                            const auto pos  = shamt;
+                            const auto size = (rd + 1) - pos;
+
+                            if (!size || (size > 32)) return false;
+
+                            if (rt == Reg::R0) return true;
+
+                            const auto mask = 0xFFFFFFFFu >> (32 - size);
+
+                            loadReg(RAX, rt);
+                            e.aluImm(ALU_AND, RAX, ~(mask << pos));
+                            loadReg(RCX, rs);
+                            e.aluImm(ALU_AND, RCX, mask);
+
+                            if (pos) e.shiftImm(SHIFT_SHL, RCX, pos);
+
+                            e.alu(ALU_OR, RAX, RCX);
+
+                            storeReg(rt, RAX);
+                        }
+                        return true;
+                    case SPECIAL3::BSHFL:
+                        switch ((BSHFL)shamt) {
+                            case BSHFL::WSBH:
+                            case BSHFL::WSBW:
+                            case BSHFL::SEB:
+                            case BSHFL::SEH:
+                                if (rd == Reg::R0) return true;
+
+                                loadReg(RAX, rt);
+
+                                switch ((BSHFL)shamt) {
+                                    case BSHFL::WSBH:
+                                        e.bswap(RAX);
+                                        e.shiftImm(SHIFT_ROR, RAX, 16);
+                                        break;
+                                    case BSHFL::WSBW:
+                                        e.bswap(RAX);
+                                        break;
+                                    case BSHFL::SEB:
+                                        e.movsx8(RAX, RAX);
+                                        break;
+                                    default:
+                                        e.movsx16(RAX, RAX);
+                                        break;
+                                }
+
+                                storeReg(rd, RAX);
+                                return true;
+                            default:
+                                return false;
+                        }
+                    default:
+                        return false;
+                }
+            default:
+                return false;
+        }
+    }
+
+    /*
+     * Translates loads and stores to a single host access into the fastmem view.
+     * Misaligned addresses and device pages (which fault) are handled by a slow path
+     * that runs the interpreter handler and jumps back.
+     */
+    bool compileLoadStore(u32 idx) {
+        const auto instr = block->instrs[idx].instr;
+
+        const auto rs = getRs(instr);
+        const auto rt = getRt(instr);
+        const auto simm = (u32)(i16)getImm(instr);
+
+        int size;
+        bool isStore = false, isSigned = false;
+
+        switch ((Opcode)getOpcode(instr)) {
+            case Opcode::LB : size = 1; isSigned = true; break;
+            case Opcode::LBU: size = 1; break;
+            case Opcode::LH : size = 2; isSigned = true; break;
+            case Opcode::LHU: size = 2; break;
+            case Opcode::LW : size = 4; break;
+            case Opcode::SB : size = 1; isStore = true; break;
+            case Opcode::SH : size = 2; isStore = true; break;
+            case Opcode::SW : size = 4; isStore = true; break;
+            default:
+                return false;
+        }
+
+        // Loads to R0 can still have device side effects
+        if (!isStore && (rt == Reg::R0)) return false;
+
+        SlowPath path;
+
+        path.idx = idx;
+        path.alignJump = NO_JUMP;
+
+        loadReg(RCX, rs);
+
+        if (simm) e.aluImm(ALU_ADD, RCX, simm);
+
+        if (size > 1) {
+            e.testImm(RCX, size - 1);
+
+            path.alignJump = e.jcc(CC_NE);
+        }
+
+        e.aluImm(ALU_AND, RCX, (u32)memory::MemoryBase::PAddrSpace - 1);
+        e.movImm64(RDX, (u64)fastmemBase);
+
+        if (isStore) {
+            loadReg(RAX, rt);
+
+            path.faultPos = e.pos;
+
+            e.movStoreIdx(size, RAX);
+        } else {
+            path.faultPos = e.pos;
+
+            e.movLoadIdx(RAX, size, isSigned);
+
+            storeReg(rt, RAX);
+        }
+
+        path.resumePos = e.pos;
+
+        slowPaths.push_back(path);
+
+        return true;
+    }
+
+    // Emits the slow paths of all fastmem accesses after the block
+    void compileSlowPaths() {
+        for (auto &path : slowPaths) {
+            const auto addr = baseAddr + 4 * path.idx;
+
+            if (path.alignJump != NO_JUMP) e.patchJump(path.alignJump);
+
+            path.stubPos = e.pos;
+
+            // The fast path doesn't keep PC/NPC up to date
+            setPC(addr + 4);
+            setNPC(addr + 8);
+            callHandler(block->instrs[path.idx], addr);
+
+            // Leave the block if an exception was raised or the guest exit halted the core
+            e.cmpMemImm(getPCOffset(), addr + 4);
+
+            const auto exit = e.jcc(CC_NE);
+
+            e.cmpMemImm8(getHaltedOffset(), 0);
+
+            const auto haltExit = e.jcc(CC_NE);
+
+            e.jmpTo(path.resumePos);
+
+            e.patchJump(haltExit);
+            e.patchJump(exit);
+
+            exitBlock(path.idx + 1);
+        }
+    }
+
+    // Evaluates a branch condition, returns false if the instruction isn't a translatable branch
+    bool compileBranchCond(u32 instr, u32 addr, Cond &cond, u32 &target, int &linkReg, bool &isLikely) {
+        const auto rs = getRs(instr);
+        const auto rt = getRt(instr);
+
+        linkReg  = Reg::R0;
+        isLikely = false;
+
+        target = (addr + 4) + ((u32)(i16)getImm(instr) << 2);
+
+        switch ((Opcode)getOpcode(instr)) {
+            case Opcode::REGIMM:
+                switch ((REGIMM)rt) {
+                    case REGIMM::BLTZ  : cond = CC_L ; break;
+                    case REGIMM::BGEZ  : cond = CC_GE; break;
+                    case REGIMM::BLTZL : cond = CC_L ; isLikely = true; break;
+                    case REGIMM::BGEZL : cond = CC_GE; isLikely = true; break;
+                    case REGIMM::BLTZAL: cond = CC_L ; linkReg = Reg::RA; break;
+                    case REGIMM::BGEZAL: cond = CC_GE; linkReg = Reg::RA; break;
+                    default:
+                        return false;
+                }
+
+                if (!target) return false;
+
+                loadReg(RAX, rs);
+                e.test(RAX, RAX);
+                return true;
+            case Opcode::J:
+            case Opcode::JAL:
+                target = ((addr + 4) & 0xF0000000) | (getOffset(instr) << 2);
+
+                if (!target) return false;
+
+                if ((Opcode)getOpcode(instr) == Opcode::JAL) linkReg = Reg::RA;
+
+                cond = CC_O; // Unused
+                return true;
+            case Opcode::BEQ : case Opcode::BEQL : cond = CC_E ; break;
+            case Opcode::BNE : case Opcode::BNEL : cond = CC_NE; break;
+            case Opcode::BLEZ: case Opcode::BLEZL: cond = CC_LE; break;
+            case Opcode::BGTZ: case Opcode::BGTZL: cond = CC_G ; break;
+            default:
+                return false;
+        }
+
+        if (!target) return false;
+
+        switch ((Opcode)getOpcode(instr)) {
+            case Opcode::BEQL: case Opcode::BNEL: case Opcode::BLEZL: case Opcode::BGTZL:
+                isLikely = true;
+                break;
+            default:
+                break;
+        }
+
+        loadReg(RAX, rs);
+
+        switch ((Opcode)getOpcode(instr)) {
+            case Opcode::BEQ: case Opcode::BEQL: case Opcode::BNE: case Opcode::BNEL:
+                loadReg(RCX, rt);
+                e.alu(ALU_CMP, RAX, RCX);
+                break;
+            default:
+                e.test(RAX, RAX);
+                break;
+        }
+
+        return true;
+    }
+
+    // Compiles the instruction in a delay slot, PC/NPC already hold the post-delay slot values
+    void compileDelaySlot(u32 idx) {
+        const auto &entry = block->instrs[idx];
+
+        // Branches in delay slots are handled (and rejected) by the interpreter
+        if (!compileOp(idx) && (interpreter::isBranch(entry.instr) || !compileALU(entry.instr))) {
+            callHandler(entry, baseAddr + 4 * idx);
+        }
+
+        exitBlock(idx + 1);
+    }
+
+    // Compiles a branch at idx and its delay slot
+    void compileBranch(u32 idx) {
+        const auto &entry = block->instrs[idx];
+
+        const auto addr = baseAddr + 4 * idx;
+
+        const bool hasDelaySlot = (idx + 1) < block->instrs.size();
+
+        Cond cond;
+        u32 target;
+        int linkReg;
+        bool isLikely;
+
+        const auto start = e.pos;
+
+        if (!compileBranchCond(entry.instr, addr, cond, target, linkReg, isLikely)) {
+            e.pos = start;
+
+            // Let the interpreter handle this branch
+            syncPC(addr + 4);
+            callHandler(entry, addr);
+
+            if (!hasDelaySlot) {
+                exitBlock(idx + 1);
+
+                return;
+            }
+
+            // Likely branch wasn't taken or an exception was raised
+            e.cmpMemImm(getPCOffset(), addr + 4);
+
+            const auto skipExit = e.jcc(CC_E);
+
+            exitBlock(idx + 1);
+
+            e.patchJump(skipExit);
+
+            // Advance PC and delay slot state like the interpreter does
+            e.movLoad8(RAX, getDelaySlotOffset(1));
+            e.movStore8(getDelaySlotOffset(0), RAX);
+            e.movStoreImm8(getDelaySlotOffset(1), 0);
+            e.movLoad(RAX, getNPCOffset());
+            e.movStore(getPCOffset(), RAX);
+            e.aluImm(ALU_ADD, RAX, 4);
+            e.movStore(getNPCOffset(), RAX);
+
+            compileDelaySlot(idx + 1);
+
+            return;
+        }
+
+        const bool isUnconditional = ((Opcode)getOpcode(entry.instr) == Opcode::J) || ((Opcode)getOpcode(entry.instr) == Opcode::JAL);
+
+        // MOVs don't modify flags
+        if (linkReg != Reg::R0) e.movStoreImm(getRegOffset(linkReg), addr + 8);
+
+        if (isLikely) {
+            const auto taken = e.jcc(cond);
+
+            // Skip delay slot
+            setPC(addr + 8);
+            setNPC(addr + 12);
+            exitBlock(idx + 1);
+
+            e.patchJump(taken);
+
+            if (hasDelaySlot) {
+                setPC(target);
+                setNPC(target + 4);
+                e.movStoreImm8(getDelaySlotOffset(0), 1);
+
+                compileDelaySlot(idx + 1);
+            } else {
+                setPC(addr + 4);
+                setNPC(target);
+                e.movStoreImm8(getDelaySlotOffset(1), 1);
+
+                exitBlock(idx + 1);
+            }
+
+            return;
+        }
+
+        if (!isUnconditional) {
+            e.movImm(RCX, addr + 8);
+            e.movImm(RDX, target);
+            e.cmov(cond, RCX, RDX);
+        }
+
+        if (hasDelaySlot) {
+            if (isUnconditional) {
+                setPC(target);
+                setNPC(target + 4);
+            } else {
+                e.movStore(getPCOffset(), RCX);
+                e.aluImm(ALU_ADD, RCX, 4);
+                e.movStore(getNPCOffset(), RCX);
+            }
+
+            e.movStoreImm8(getDelaySlotOffset(0), 1);
+
+            compileDelaySlot(idx + 1);
+        } else {
+            // Delay slot is executed by the next block
+            setPC(addr + 4);
+
+            if (isUnconditional) {
+                setNPC(target);
+            } else {
+                e.movStore(getNPCOffset(), RCX);
+            }
+
+            e.movStoreImm8(getDelaySlotOffset(1), 1);
+
+            exitBlock(idx + 1);
+        }
+    }
+
+    void compile() {
+        e.push(RBX);
+        e.mov64(RBX, RDI);
+
+        // The first instruction is never in a delay slot
+        e.movStoreImm8(getDelaySlotOffset(0), 0);
+
+        statePC = baseAddr;
+
+        const auto size = (u32)block->instrs.size();
+
+        for (u32 i = 0; i < size; i++) {
+            const auto &entry = block->instrs[i];
+
+            const auto addr = baseAddr + 4 * i;
+
+            if (interpreter::isBranch(entry.instr)) {
+                compileBranch(i);
+
+                return;
+            }
+
+            if (compileOp(i) || compileALU(entry.instr)) continue;
+
+            // Constant device addresses would fault on every access
+            if ((fastmemBase != NULL) && !block->ops[i].isDevice && compileLoadStore(i)) continue;
+
+            syncPC(addr + 4);
+            callHandler(entry, addr);
+
+            const bool isHalt = ((Opcode)getOpcode(entry.instr) == Opcode::SPECIAL2) && ((SPECIAL2)getFunct(entry.instr) == SPECIAL2::HALT);
+
+            if (((i + 1) == size) || isHalt) {
+                exitBlock(i + 1);
+
+                return;
+            }
+
+            // Leave the block if an exception was raised or the guest exit halted the core
+            e.cmpMemImm(getPCOffset(), addr + 4);
+
+            const auto exit = e.jcc(CC_NE);
+
+            e.cmpMemImm8(getHaltedOffset(), 0);
+
+            const auto skipExit = e.jcc(CC_E);
+
+            e.patchJump(exit);
+
+            exitBlock(i + 1);
+
+            e.patchJump(skipExit);
+        }
+
+        syncPC(baseAddr + 4 * size);
+        exitBlock(size);
+    }
+};
+
+void compile(Allegrex *allegrex, Block *block, u32 addr) {
+    auto &buffer = codeBuffers[allegrex->isME()];
+
+    const auto maxSize = MAX_INSTR_SIZE * block->instrs.size() + MAX_BLOCK_EXTRA;
+
+    if ((buffer.used + maxSize) > CODE_BUFFER_SIZE) {
+        std::printf("[JIT     ] %s code buffer full, flushing\n", allegrex->getTypeName());
+
+        // Drops all compiled code, this block stays valid until the next lookup
+        blockcache::invalidateAll(allegrex);
+
+        buffer.fastmemSites.clear();
+
+        buffer.used = 0;
+    }
+
+    Compiler compiler;
+
+    compiler.e.buf = &buffer.base[buffer.used];
+    compiler.e.pos = 0;
+    compiler.allegrex = allegrex;
+    compiler.block = block;
+    compiler.baseAddr = addr;
+#ifdef JIT_FASTMEM
+    compiler.fastmemBase = memory::getFastmemBase(allegrex->isME());
+#else
+    compiler.fastmemBase = NULL;
+#endif
+
+    compiler.compile();
+    compiler.compileSlowPaths();
+
+    for (const auto &path : compiler.slowPaths) {
+        buffer.fastmemSites[(u64)&compiler.e.buf[path.faultPos]] = (u64)&compiler.e.buf[path.stubPos];
+    }
+
+    block->code = (blockcache::CodeFunc)compiler.e.buf;
+    block->codeAddr = addr;
+
+    // Keep blocks 16-byte aligned
+    buffer.used += (compiler.e.pos + 15) & ~(u64)15;
+}
+
+#ifdef JIT_FASTMEM
+// Redirects faulting fastmem accesses to their slow path
+void handleSegfault(int sig, siginfo_t *info, void *context) {
+    (void)sig;
+
+    auto &rip = ((ucontext_t *)context)->uc_mcontext.gregs[REG_RIP];
+
+    if (memory::isFastmemAddress(info->si_addr)) {
+        for (const auto &buffer : codeBuffers) {
+            if (((u64)rip < (u64)buffer.base) || ((u64)rip >= ((u64)buffer.base + CODE_BUFFER_SIZE))) continue;
+
+            const auto site = buffer.fastmemSites.find((u64)rip);
+
+            if (site != buffer.fastmemSites.end()) {
+                rip = (greg_t)site->second;
+
+                return;
+            }
+        }
+    }
+
+    // Not ours, the access faults again with the previous handler
+    sigaction(SIGSEGV, &oldSegvAction, NULL);
+}
+#endif
+
+bool init() {
+#ifdef JIT_FASTMEM
+    if (memory::getFastmemBase(false) != NULL) {
+        struct sigaction action = {};
+
+        action.sa_sigaction = &handleSegfault;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+
+        if (sigaction(SIGSEGV, &action, &oldSegvAction) < 0) {
+            std::puts("[JIT     ] Unable to install fault handler");
+
+            return false;
+        }
+    }
+#endif
+
+    for (auto &buffer : codeBuffers) {
+        void *base = mmap(NULL, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (base == MAP_FAILED) {
+            std::puts("[JIT     ] Unable to allocate code buffer");
+
+            return false;
+        }
+
+        buffer.base = (u8 *)base;
+        buffer.used = 0;
+    }
+
+    isAvailable = true;
+
+    return true;
+}
+
+// Runs the compiled code of a block, returns false if the block has to be interpreted
+bool runCompiled(Allegrex *allegrex, Block *block, u32 pc, i64 sliceCycles) {
+    // Compiled blocks can't start in a delay slot and always run to completion
+    if (allegrex->isDelaySlotPending() || ((sliceCycles - allegrex->cycles) < (i64)block->instrs.size())) return false;
+
+    if ((block->code == NULL) || (block->codeAddr != pc)) compile(allegrex, block, pc);
+
+    // Device accesses in compiled code catch up to the start of the block
+    allegrex->cycles += block->code(allegrex);
+    allegrex->blockCycles = 0;
+
+    return true;
+}
+
+void run(Allegrex *allegrex) {
+    allegrex->isIdle = false;
+
+    const auto clockShift = interpreter::getClockShift(allegrex);
+
+    allegrex->cycles = 0;
+
+    while (allegrex->cycles < scheduler::getSliceCycles(clockShift)) {
+        if (allegrex->isHalted) return;
+
+        const auto pc = allegrex->getPC();
+
+        const auto block = blockcache::getBlock(allegrex, pc);
+
+        const auto ioCount = memory::getIOCount(allegrex->isME());
+        const auto inDelaySlot = allegrex->isDelaySlotPending();
+
+        const auto sliceCycles = scheduler::getSliceCycles(clockShift);
+
+        if (config::lockstep) lockstep::beginBlock(allegrex);
+
+        if (!runCompiled(allegrex, block, pc, sliceCycles)) interpreter::runBlock(allegrex, block, sliceCycles);
+
+        if (config::lockstep) lockstep::endBlock(allegrex, block);
+
+        if (!inDelaySlot && interpreter::checkIdleBlock(allegrex, block, pc, ioCount)) return;
+    }
+}
+
+#else
+
+bool init() {
+    std::puts("[JIT     ] Unsupported host");
+
+    return false;
+}
+
+bool runCompiled(Allegrex *allegrex, blockcache::Block *block, u32 pc, i64 sliceCycles) {
+    (void)allegrex;
+    (void)block;
+    (void)pc;
+    (void)sliceCycles;
+
+    return false;
+}
+
+void run(Allegrex *allegrex) {
+    interpreter::runCached(allegrex);
+}
+
+#endif
+
+void runTiered(Allegrex *allegrex) {
+    allegrex->isIdle = false;
+
+    const auto clockShift = interpreter::getClockShift(allegrex);
+
+    allegrex->cycles = 0;
+
+    while (allegrex->cycles < scheduler::getSliceCycles(clockShift)) {
+        if (allegrex->isHalted) return;
+
+        const auto pc = allegrex->getPC();
+
+        const auto sliceCycles = scheduler::getSliceCycles(clockShift);
+
+        const auto block = blockcache::getWarmBlock(allegrex, pc, config::tierCachedRuns);
+
+        // Cold code isn't decoded, it has to run tierCachedRuns times first
+        if (block == NULL) {
+            interpreter::runColdBlock(allegrex, sliceCycles);
+
+            continue;
+        }
+
+        const auto ioCount = memory::getIOCount(allegrex->isME());
+        const auto inDelaySlot = allegrex->isDelaySlotPending();
+
+        if (block->runCount < config::tierJITRuns) block->runCount++;
+
+        const bool isHot = isAvailable && (block->runCount >= config::tierJITRuns);
+
+        if (config::lockstep) lockstep::beginBlock(allegrex);
+
+        if (!isHot || !runCompiled(allegrex, block, pc, sliceCycles)) interpreter::runBlock(allegrex, block, sliceCycles);
+
+        if (config::lockstep) lockstep::endBlock(allegrex, block);
+
+        if (!inDelaySlot && interpreter::checkIdleBlock(allegrex, block, pc, ioCount)) return;
+    }
+}
+
+}
@@ -0,0 +1,26 @@
+/*
+ * ChiSP is a PlayStation Portable emulator written in C++.
+ * Copyright (C) 2023  noumidev
+ */
+
+#pragma once
+
+#include "../../common/types.hpp"
+
+namespace psp::allegrex {
+
+struct Allegrex;
+
+}
+
+namespace psp::allegrex::jit {
+
+bool init();
+
+// Engines run until the end of the current scheduler slice
+void run(Allegrex *allegrex);
+
+// Interprets cold code, caches warm blocks and compiles hot blocks if the JIT is available
+void runTiered(Allegrex *allegrex);
+
+}
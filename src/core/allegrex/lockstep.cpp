@@ -0,0 +1,238 @@
+/*
+ * ChiSP is a PlayStation Portable emulator written in C++.
+ * Copyright (C) 2023  noumidev
+ */
+
+#include "lockstep.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "allegrex.hpp"
+#include "blockcache.hpp"
+#include "interpreter.hpp"
+#include "vfpu.hpp"
+#include "../memory.hpp"
+#include "../scheduler.hpp"
+
+namespace psp::allegrex::lockstep {
+
+constexpr u32 WINDOW_SIZE = 4; // Instructions shown before the block
+
+// COP0 status registers that hold state, see cop0.cpp
+constexpr int COP0_STATUS_REGS[] = {0x08, 0x09, 0x0B, 0x0C, 0x0D, 0x0E, 0x15, 0x19, 0x1C, 0x1D, 0x1E};
+
+const char *gprNames[] = {
+    "R0", "AT", "V0", "V1", "A0", "A1", "A2", "A3",
+    "T0", "T1", "T2", "T3", "T4", "T5", "T6", "T7",
+    "S0", "S1", "S2", "S3", "S4", "S5", "S6", "S7",
+    "T8", "T9", "K0", "K1", "GP", "SP", "S8", "RA",
+    "LO", "HI",
+};
+
+// Core state before the block
+struct Snapshot {
+    Allegrex allegrex;
+    vfpu::State vfpu;
+
+    u64 ioCount, scheduleCount;
+};
+
+Snapshot before;
+
+// Results of the engine under test
+Allegrex candidate;
+vfpu::State candidateVFPU;
+std::vector<memory::JournalEntry> candidateWrites;
+
+u64 checkedBlocks = 0;
+
+bool isReporting = false; // Differences are only printed on the second pass
+
+void beginBlock(Allegrex *allegrex) {
+    before.allegrex = *allegrex;
+    before.ioCount = memory::getIOCount(allegrex->isME());
+    before.scheduleCount = scheduler::getScheduleCount();
+
+    if (!allegrex->isME()) vfpu::saveState(before.vfpu);
+
+    memory::beginJournal();
+}
+
+// Prints the raw instruction words around the block, the block itself is marked
+void printWindow(Allegrex *allegrex, const blockcache::Block *block) {
+    std::puts("[Lockstep] Block:");
+
+    for (u32 i = 0; i < WINDOW_SIZE; i++) {
+        const auto addr = block->addr - 4 * (WINDOW_SIZE - i);
+
+        // Stay on the block's page, it is known to be RAM
+        if ((addr ^ block->addr) & ~0xFFFU) continue;
+
+        std::printf("[Lockstep]   0x%08X: 0x%08X\n", addr, allegrex->isME() ? memory::meRead32(addr) : memory::read32(addr));
+    }
+
+    for (u32 i = 0; i < block->instrs.size(); i++) {
+        const auto instr = block->instrs[i].instr;
+
+        std::printf("[Lockstep] > 0x%08X: 0x%08X (opcode 0x%02X, funct 0x%02X)\n", block->addr + 4 * i, instr, instr >> 26, instr & 0x3F);
+    }
+}
+
+// Compares one value, prints it if it differs. Returns true on a match
+bool check(const char *name, u32 ref, u32 cand) {
+    if (ref == cand) return true;
+
+    if (isReporting) std::printf("[Lockstep]   %-10s reference: 0x%08X, candidate: 0x%08X\n", name, ref, cand);
+
+    return false;
+}
+
+bool compareState(Allegrex *ref, Allegrex *cand) {
+    auto isMatch = true;
+
+    char name[16];
+
+    for (int i = 0; i < 34; i++) isMatch &= check(gprNames[i], ref->get(i), cand->get(i));
+
+    isMatch &= check("PC", ref->getPC(), cand->getPC());
+    isMatch &= check("Delay slot", ref->isDelaySlotPending(), cand->isDelaySlotPending());
+    isMatch &= check("Halted", ref->isHalted, cand->isHalted);
+    isMatch &= check("Cycles", (u32)ref->cycles, (u32)cand->cycles);
+
+    for (int i = 0; i < 32; i++) {
+        std::snprintf(name, sizeof(name), "F%d", i);
+
+        isMatch &= check(name, ref->fpu.get(i), cand->fpu.get(i));
+
+        std::snprintf(name, sizeof(name), "FCR%d", i);
+
+        isMatch &= check(name, ref->fpu.getControl(i), cand->fpu.getControl(i));
+    }
+
+    isMatch &= check("FPU cond", ref->fpu.cpcond, cand->fpu.cpcond);
+
+    for (const auto idx : COP0_STATUS_REGS) {
+        std::snprintf(name, sizeof(name), "COP0 $%d", idx);
+
+        isMatch &= check(name, ref->cop0.getStatus(idx), cand->cop0.getStatus(idx));
+    }
+
+    for (int i = 0; i < 32; i++) {
+        std::snprintf(name, sizeof(name), "COP0 C%d", i);
+
+        isMatch &= check(name, ref->cop0.getControl(i), cand->cop0.getControl(i));
+    }
+
+    return isMatch;
+}
+
+bool compareVFPU(const vfpu::State &ref, const vfpu::State &cand) {
+    if (!std::memcmp(&ref, &cand, sizeof(vfpu::State))) return true;
+
+    if (isReporting) std::puts("[Lockstep]   VFPU state differs");
+
+    return false;
+}
+
+// Returns the last value written to every byte
+std::unordered_map<u8 *, u8> getWrittenBytes(const std::vector<memory::JournalEntry> &writes) {
+    std::unordered_map<u8 *, u8> bytes;
+
+    for (const auto &entry : writes) {
+        for (u32 i = 0; i < entry.size; i++) bytes[&entry.mem[i]] = entry.newData[i];
+    }
+
+    return bytes;
+}
+
+// Both runs have to leave the same RAM contents, the optimizer may drop redundant stores
+bool compareWrites(const std::vector<memory::JournalEntry> &ref, const std::vector<memory::JournalEntry> &cand) {
+    const auto candBytes = getWrittenBytes(cand);
+
+    // RAM holds the results of the reference run
+    for (const auto &[mem, data] : candBytes) {
+        if (*mem != data) {
+            if (isReporting) std::printf("[Lockstep]   RAM byte %p reference: 0x%02X, candidate: 0x%02X\n", (void *)mem, *mem, data);
+
+            return false;
+        }
+    }
+
+    // Bytes only written by the reference must have kept their value from before the block
+    std::unordered_map<u8 *, u8> oldBytes;
+
+    for (const auto &entry : ref) {
+        for (u32 i = 0; i < entry.size; i++) oldBytes.try_emplace(&entry.mem[i], entry.oldData[i]);
+    }
+
+    for (const auto &[mem, data] : oldBytes) {
+        if (!candBytes.contains(mem) && (*mem != data)) {
+            if (isReporting) std::printf("[Lockstep]   RAM byte %p reference: 0x%02X, candidate: 0x%02X\n", (void *)mem, *mem, data);
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void endBlock(Allegrex *allegrex, const blockcache::Block *block) {
+    const auto &writes = memory::endJournal();
+
+    // Device accesses and scheduled events can't be repeated, trust the engine for this block
+    if ((memory::getIOCount(allegrex->isME()) != before.ioCount) || (scheduler::getScheduleCount() != before.scheduleCount)) return;
+
+    candidate = *allegrex;
+    candidateWrites = writes;
+
+    if (!allegrex->isME()) vfpu::saveState(candidateVFPU);
+
+    // Rewind and run the same number of instructions with the interpreter
+    memory::rollbackJournal(candidateWrites);
+
+    *allegrex = before.allegrex;
+
+    if (!allegrex->isME()) vfpu::loadState(before.vfpu);
+
+    memory::beginJournal();
+
+    while (allegrex->cycles < candidate.cycles) interpreter::step(allegrex);
+
+    const auto &refWrites = memory::endJournal();
+
+    vfpu::State refVFPU;
+
+    if (!allegrex->isME()) vfpu::saveState(refVFPU);
+
+    const auto compare = [&]() {
+        auto isMatch = compareState(allegrex, &candidate);
+
+        isMatch &= compareWrites(refWrites, candidateWrites);
+
+        if (!allegrex->isME()) isMatch &= compareVFPU(refVFPU, candidateVFPU);
+
+        return isMatch;
+    };
+
+    if (compare()) {
+        checkedBlocks++;
+
+        return;
+    }
+
+    std::printf("[Lockstep] %s diverged in block @ 0x%08X after %llu matching blocks\n", allegrex->getTypeName(), block->addr, (unsigned long long)checkedBlocks);
+
+    isReporting = true;
+
+    compare();
+
+    printWindow(allegrex, block);
+
+    exit(0);
+}
+
+}
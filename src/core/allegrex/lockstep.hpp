@@ -0,0 +1,31 @@
+/*
+ * ChiSP is a PlayStation Portable emulator written in C++.
+ * Copyright (C) 2023  noumidev
+ */
+
+#pragma once
+
+#include "../../common/types.hpp"
+
+namespace psp::allegrex {
+
+struct Allegrex;
+
+}
+
+namespace psp::allegrex::blockcache {
+
+struct Block;
+
+}
+
+// Lock-step checker, re-runs every block of a fast engine with the reference interpreter
+namespace psp::allegrex::lockstep {
+
+// Snapshots the core before a block runs
+void beginBlock(Allegrex *allegrex);
+
+// Re-runs the block with the interpreter and compares, exits on the first divergence
+void endBlock(Allegrex *allegrex, const blockcache::Block *block);
+
+}
@@ -0,0 +1,200 @@
+/*
+ * ChiSP is a PlayStation Portable emulator written in C++.
+ * Copyright (C) 2023  noumidev
+ */
+
+#pragma once
+
+#include "../../common/types.hpp"
+
+namespace psp::allegrex::interpreter {
+
+enum Reg {
+    R0 =  0, AT =  1, V0 =  2, V1 =  3,
+    A0 =  4, A1 =  5, A2 =  6, A3 =  7,
+    T0 =  8, T1 =  9, T2 = 10, T3 = 11,
+    T4 = 12, T5 = 13, T6 = 14, T7 = 15,
+    S0 = 16, S1 = 17, S2 = 18, S3 = 19,
+    S4 = 20, S5 = 21, S6 = 22, S7 = 23,
+    T8 = 24, T9 = 25, K0 = 26, K1 = 27,
+    GP = 28, SP = 29, S8 = 30, RA = 31,
+    LO = 32, HI = 33,
+};
+
+enum class Opcode {
+    SPECIAL = 0x00,
+    REGIMM  = 0x01,
+    J = 0x02,
+    JAL  = 0x03,
+    BEQ  = 0x04,
+    BNE  = 0x05,
+    BLEZ  = 0x06,
+    BGTZ  = 0x07,
+    ADDI  = 0x08,
+    ADDIU = 0x09,
+    SLTI  = 0x0A,
+    SLTIU = 0x0B,
+    ANDI = 0x0C,
+    ORI  = 0x0D,
+    XORI = 0x0E,
+    LUI  = 0x0F,
+    COP0 = 0x10,
+    COP1 = 0x11,
+    COP2 = 0x12,
+    BEQL = 0x14,
+    BNEL = 0x15,
+    BLEZL = 0x16,
+    BGTZL = 0x17,
+    SPECIAL2 = 0x1C,
+    SPECIAL3 = 0x1F,
+    LB  = 0x20,
+    LH  = 0x21,
+    LWL = 0x22,
+    LW  = 0x23,
+    LBU = 0x24,
+    LHU = 0x25,
+    LWR = 0x26,
+    SB  = 0x28,
+    SH  = 0x29,
+    SWL = 0x2A,
+    SW  = 0x2B,
+    SWR = 0x2E,
+    CACHE = 0x2F,
+    LWC1  = 0x31,
+    SWC1  = 0x39,
+    SQC2  = 0x3E,
+};
+
+enum class SPECIAL {
+    SLL  = 0x00,
+    SRL  = 0x02,
+    SRA  = 0x03,
+    SLLV = 0x04,
+    SRLV = 0x06,
+    SRAV = 0x07,
+    JR = 0x08,
+    JALR = 0x09,
+    MOVZ = 0x0A,
+    MOVN = 0x0B,
+    SYSCALL = 0x0C,
+    SYNC = 0x0F,
+    MFHI = 0x10,
+    MTHI = 0x11,
+    MFLO = 0x12,
+    MTLO = 0x13,
+    CLZ = 0x16,
+    MULT  = 0x18,
+    MULTU = 0x19,
+    DIV  = 0x1A,
+    DIVU = 0x1B,
+    ADD  = 0x20,
+    ADDU = 0x21,
+    SUB  = 0x22,
+    SUBU = 0x23,
+    AND = 0x24,
+    OR  = 0x25,
+    XOR = 0x26,
+    NOR = 0x27,
+    SLT  = 0x2A,
+    SLTU = 0x2B,
+    MAX = 0x2C,
+    MIN = 0x2D,
+};
+
+enum class SPECIAL2 {
+    HALT = 0x00,
+    MFIC = 0x24,
+    MTIC = 0x26,
+};
+
+enum class SPECIAL3 {
+    EXT = 0x00,
+    INS = 0x04,
+    BSHFL = 0x20,
+};
+
+enum class BSHFL {
+    WSBH = 0x02,
+    WSBW = 0x03,
+    SEB = 0x10,
+    BITREV = 0x14,
+    SEH = 0x18,
+};
+
+enum class REGIMM {
+    BLTZ  = 0x00,
+    BGEZ  = 0x01,
+    BLTZL = 0x02,
+    BGEZL = 0x03,
+    BLTZAL = 0x10,
+    BGEZAL = 0x11,
+};
+
+enum class COPOpcode {
+    MFC  = 0x00,
+    CFC  = 0x02,
+    MFHC = 0x03,
+    MTC  = 0x04,
+    CTC  = 0x06,
+    BC = 0x08,
+    CO = 0x10,
+    W = 0x14,
+};
+
+enum class COP0Opcode {
+    ERET = 0x18,
+};
+
+enum class BC {
+    BCF  = 0,
+    BCT  = 1,
+    BCFL = 2,
+    BCTL = 3,
+};
+
+enum class CACHE {
+    ICACHE_INDEX_INVALIDATE = 0x04,
+    ICACHE_HIT_INVALIDATE = 0x08,
+};
+
+// Returns primary opcode
+inline u32 getOpcode(u32 instr) {
+    return instr >> 26;
+}
+
+// Returns secondary opcode
+inline u32 getFunct(u32 instr) {
+    return instr & 0x3F;
+}
+
+// Returns shift amount
+inline u32 getShamt(u32 instr) {
+    return (instr >> 6) & 0x1F;
+}
+
+// Returns 16-bit immediate
+inline u32 getImm(u32 instr) {
+    return instr & 0xFFFF;
+}
+
+// Returns branch offset
+inline u32 getOffset(u32 instr) {
+    return instr & 0x3FFFFFF;
+}
+
+// Returns Rd
+inline u32 getRd(u32 instr) {
+    return (instr >> 11) & 0x1F;
+}
+
+// Returns Rs
+inline u32 getRs(u32 instr) {
+    return (instr >> 21) & 0x1F;
+}
+
+// Returns Rt
+inline u32 getRt(u32 instr) {
+    return (instr >> 16) & 0x1F;
+}
+
+}
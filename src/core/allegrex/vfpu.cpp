@@ -7,11 +7,10 @@
 
 #include <cassert>
 #include <cstdio>
+#include <cstring>
 
 namespace psp::allegrex::vfpu {
 
-constexpr int NUM_VREGS = 128;
-
 u32 vregs[NUM_VREGS];
 
 // Prefix stacks
@@ -48,6 +47,30 @@ enum {
     VFPU_RCX7 = 143,
 };
 
+void saveState(State &state) {
+    std::memcpy(state.vregs, vregs, sizeof(vregs));
+    std::memcpy(state.pfx, pfx, sizeof(pfx));
+    std::memcpy(state.rcx, rcx, sizeof(rcx));
+
+    state.cc = cc;
+    state.inf4 = inf4;
+    state.rsv5 = rsv5;
+    state.rsv6 = rsv6;
+    state.rev = rev;
+}
+
+void loadState(const State &state) {
+    std::memcpy(vregs, state.vregs, sizeof(vregs));
+    std::memcpy(pfx, state.pfx, sizeof(pfx));
+    std::memcpy(rcx, state.rcx, sizeof(rcx));
+
+    cc = state.cc;
+    inf4 = state.inf4;
+    rsv5 = state.rsv5;
+    rsv6 = state.rsv6;
+    rev = state.rev;
+}
+
 u32 getControl(int idx) {
     if (idx < 128) {
         return vregs[idx];
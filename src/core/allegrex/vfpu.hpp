@@ -9,6 +9,21 @@
 
 namespace psp::allegrex::vfpu {
 
+constexpr int NUM_VREGS = 128;
+
+// Architectural state, used to snapshot the VFPU
+struct State {
+    u32 vregs[NUM_VREGS];
+    u32 pfx[3];
+    u32 cc;
+    u32 inf4, rsv5, rsv6;
+    u32 rev;
+    u32 rcx[8];
+};
+
+void saveState(State &state);
+void loadState(const State &state);
+
 u32 getControl(int idx);
 
 // Matrix reads
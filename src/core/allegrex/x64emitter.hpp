@@ -0,0 +1,349 @@
+/*
+ * ChiSP is a PlayStation Portable emulator written in C++.
+ * Copyright (C) 2023  noumidev
+ */
+
+#pragma once
+
+#include <cstring>
+
+#include "../../common/types.hpp"
+
+namespace psp::allegrex::jit {
+
+// x86-64 registers
+enum HostReg {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3,
+    RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+};
+
+// x86-64 condition codes
+enum Cond {
+    CC_O  = 0x0, CC_NO = 0x1, CC_B  = 0x2, CC_AE = 0x3,
+    CC_E  = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A  = 0x7,
+    CC_S  = 0x8, CC_NS = 0x9, CC_P  = 0xA, CC_NP = 0xB,
+    CC_L  = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G  = 0xF,
+};
+
+// Group 1 ALU operations (/digit of opcodes 0x81/0x83)
+enum ALUOp {
+    ALU_ADD = 0, ALU_OR  = 1, ALU_AND = 4,
+    ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7,
+};
+
+// Group 2 shift operations (/digit of opcodes 0xC1/0xD3)
+enum ShiftOp {
+    SHIFT_ROL = 0, SHIFT_ROR = 1, SHIFT_SHL = 4, SHIFT_SHR = 5, SHIFT_SAR = 7,
+};
+
+// Minimal x86-64 code emitter, memory operands are [RBX + disp32] or [RDX + RCX]
+struct Emitter {
+    u8 *buf;
+    u64 pos;
+
+    u8 *getCursor() {
+        return &buf[pos];
+    }
+
+    void emit8(u8 data) {
+        buf[pos++] = data;
+    }
+
+    void emit32(u32 data) {
+        std::memcpy(&buf[pos], &data, sizeof(u32));
+
+        pos += sizeof(u32);
+    }
+
+    void emit64(u64 data) {
+        std::memcpy(&buf[pos], &data, sizeof(u64));
+
+        pos += sizeof(u64);
+    }
+
+    // ModRM with register operand
+    void modrmReg(int reg, int rm) {
+        emit8(0xC0 | (reg << 3) | rm);
+    }
+
+    // ModRM with [RBX + disp32] operand
+    void modrmMem(int reg, i32 disp) {
+        emit8(0x80 | (reg << 3) | RBX);
+        emit32(disp);
+    }
+
+    // ModRM with [RDX + RCX] operand
+    void modrmIdx(int reg) {
+        emit8(0x04 | (reg << 3));
+        emit8((RCX << 3) | RDX);
+    }
+
+    // MOV r32, [RBX + disp32]
+    void movLoad(HostReg dst, i32 disp) {
+        emit8(0x8B);
+        modrmMem(dst, disp);
+    }
+
+    // MOV [RBX + disp32], r32
+    void movStore(i32 disp, HostReg src) {
+        emit8(0x89);
+        modrmMem(src, disp);
+    }
+
+    // MOV dword [RBX + disp32], imm32
+    void movStoreImm(i32 disp, u32 imm) {
+        emit8(0xC7);
+        modrmMem(0, disp);
+        emit32(imm);
+    }
+
+    // MOV r8, [RBX + disp32]
+    void movLoad8(HostReg dst, i32 disp) {
+        emit8(0x8A);
+        modrmMem(dst, disp);
+    }
+
+    // MOV [RBX + disp32], r8
+    void movStore8(i32 disp, HostReg src) {
+        emit8(0x88);
+        modrmMem(src, disp);
+    }
+
+    // MOV byte [RBX + disp32], imm8
+    void movStoreImm8(i32 disp, u8 imm) {
+        emit8(0xC6);
+        modrmMem(0, disp);
+        emit8(imm);
+    }
+
+    // MOV/MOVZX/MOVSX r32, [RDX + RCX]
+    void movLoadIdx(HostReg dst, int size, bool isSigned) {
+        switch (size) {
+            case 1:
+                emit8(0x0F);
+                emit8(isSigned ? 0xBE : 0xB6);
+                break;
+            case 2:
+                emit8(0x0F);
+                emit8(isSigned ? 0xBF : 0xB7);
+                break;
+            default:
+                emit8(0x8B);
+                break;
+        }
+
+        modrmIdx(dst);
+    }
+
+    // MOV [RDX + RCX], r8/r16/r32 (byte stores are only valid for AL, CL, DL, BL)
+    void movStoreIdx(int size, HostReg src) {
+        switch (size) {
+            case 1:
+                emit8(0x88);
+                break;
+            case 2:
+                emit8(0x66);
+                emit8(0x89);
+                break;
+            default:
+                emit8(0x89);
+                break;
+        }
+
+        modrmIdx(src);
+    }
+
+    // MOV r32, imm32
+    void movImm(HostReg dst, u32 imm) {
+        emit8(0xB8 + dst);
+        emit32(imm);
+    }
+
+    // MOV r64, imm64
+    void movImm64(HostReg dst, u64 imm) {
+        emit8(0x48);
+        emit8(0xB8 + dst);
+        emit64(imm);
+    }
+
+    // MOV r32, r32
+    void mov(HostReg dst, HostReg src) {
+        emit8(0x89);
+        modrmReg(src, dst);
+    }
+
+    // MOV r64, r64
+    void mov64(HostReg dst, HostReg src) {
+        emit8(0x48);
+        emit8(0x89);
+        modrmReg(src, dst);
+    }
+
+    // MOV dword [RAX], imm32
+    void movStoreImmRAX(u32 imm) {
+        emit8(0xC7);
+        emit8(0x00);
+        emit32(imm);
+    }
+
+    // <op> r32, r32
+    void alu(ALUOp op, HostReg dst, HostReg src) {
+        emit8(0x01 | (op << 3));
+        modrmReg(src, dst);
+    }
+
+    // <op> r32, imm32
+    void aluImm(ALUOp op, HostReg dst, u32 imm) {
+        if ((u32)(i32)(i8)imm == imm) {
+            emit8(0x83);
+            modrmReg(op, dst);
+            emit8(imm);
+        } else {
+            emit8(0x81);
+            modrmReg(op, dst);
+            emit32(imm);
+        }
+    }
+
+    // CMP dword [RBX + disp32], imm32
+    void cmpMemImm(i32 disp, u32 imm) {
+        emit8(0x81);
+        modrmMem(ALU_CMP, disp);
+        emit32(imm);
+    }
+
+    // CMP byte [RBX + disp32], imm8
+    void cmpMemImm8(i32 disp, u8 imm) {
+        emit8(0x80);
+        modrmMem(ALU_CMP, disp);
+        emit8(imm);
+    }
+
+    // TEST r32, r32
+    void test(HostReg dst, HostReg src) {
+        emit8(0x85);
+        modrmReg(src, dst);
+    }
+
+    // TEST r32, imm32
+    void testImm(HostReg dst, u32 imm) {
+        emit8(0xF7);
+        modrmReg(0, dst);
+        emit32(imm);
+    }
+
+    // NOT r32
+    void notReg(HostReg dst) {
+        emit8(0xF7);
+        modrmReg(2, dst);
+    }
+
+    // MUL r32 (EDX:EAX = EAX * r32)
+    void mul(HostReg src) {
+        emit8(0xF7);
+        modrmReg(4, src);
+    }
+
+    // <shift> r32, imm8
+    void shiftImm(ShiftOp op, HostReg dst, u8 imm) {
+        emit8(0xC1);
+        modrmReg(op, dst);
+        emit8(imm);
+    }
+
+    // <shift> r32, CL
+    void shiftCL(ShiftOp op, HostReg dst) {
+        emit8(0xD3);
+        modrmReg(op, dst);
+    }
+
+    // SETcc r8 (only valid for AL, CL, DL, BL)
+    void setcc(Cond cond, HostReg dst) {
+        emit8(0x0F);
+        emit8(0x90 + cond);
+        modrmReg(0, dst);
+    }
+
+    // MOVZX r32, r8 (only valid for AL, CL, DL, BL)
+    void movzx8(HostReg dst, HostReg src) {
+        emit8(0x0F);
+        emit8(0xB6);
+        modrmReg(dst, src);
+    }
+
+    // MOVSX r32, r8 (only valid for AL, CL, DL, BL)
+    void movsx8(HostReg dst, HostReg src) {
+        emit8(0x0F);
+        emit8(0xBE);
+        modrmReg(dst, src);
+    }
+
+    // MOVSX r32, r16
+    void movsx16(HostReg dst, HostReg src) {
+        emit8(0x0F);
+        emit8(0xBF);
+        modrmReg(dst, src);
+    }
+
+    // CMOVcc r32, r32
+    void cmov(Cond cond, HostReg dst, HostReg src) {
+        emit8(0x0F);
+        emit8(0x40 + cond);
+        modrmReg(dst, src);
+    }
+
+    // BSR r32, r32
+    void bsr(HostReg dst, HostReg src) {
+        emit8(0x0F);
+        emit8(0xBD);
+        modrmReg(dst, src);
+    }
+
+    // BSWAP r32
+    void bswap(HostReg dst) {
+        emit8(0x0F);
+        emit8(0xC8 + dst);
+    }
+
+    void push(HostReg src) {
+        emit8(0x50 + src);
+    }
+
+    void pop(HostReg dst) {
+        emit8(0x58 + dst);
+    }
+
+    // CALL r64
+    void call(HostReg target) {
+        emit8(0xFF);
+        modrmReg(2, target);
+    }
+
+    void ret() {
+        emit8(0xC3);
+    }
+
+    // Jcc rel32, returns the offset of the displacement for patching
+    u64 jcc(Cond cond) {
+        emit8(0x0F);
+        emit8(0x80 + cond);
+        emit32(0);
+
+        return pos - sizeof(u32);
+    }
+
+    // JMP rel32 to a previously emitted position
+    void jmpTo(u64 target) {
+        emit8(0xE9);
+        emit32((u32)(target - (pos + sizeof(u32))));
+    }
+
+    // Points a previously emitted jump at the current position
+    void patchJump(u64 dispPos) {
+        const auto disp = (u32)(pos - (dispPos + sizeof(u32)));
+
+        std::memcpy(&buf[dispPos], &disp, sizeof(u32));
+    }
+};
+
+}
@@ -136,7 +136,7 @@ void clearIRQ() {
 void startSCSICommand(int cyclesUntilEvent) {
     status |= ATAStatus::DEVICE_BUSY;
 
-    scheduler::addEvent(idFinishSCSICommand, 0, cyclesUntilEvent);
+    scheduler::addDeviceEvent(idFinishSCSICommand, 0, cyclesUntilEvent);
 }
 
 void finishSCSICommand() {
@@ -0,0 +1,224 @@
+/*
+ * ChiSP is a PlayStation Portable emulator written in C++.
+ * Copyright (C) 2023  noumidev
+ */
+
+#include "config.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace psp::config {
+
+CPUEngine cpuEngine = CPUEngine::Interpreter;
+Timing timing = Timing::Accurate;
+
+bool fastmem = false;
+bool meThread = false;
+bool headless = false;
+bool lockstep = false;
+
+u64 maxFrames = 0;
+i64 maxCycles = 0;
+
+const char *dumpPath = NULL;
+
+const char *blockCachePath = NULL;
+
+const char *guestPath = NULL;
+u32 guestAddr = 0x08800000;
+
+i64 maxSliceCycles = 32768;
+
+u32 tierCachedRuns = 2;
+u32 tierJITRuns = 64;
+
+// Returns value of "--name=value" options, NULL if option doesn't match
+const char *getValue(const char *option, const char *name) {
+    const auto size = std::strlen(name);
+
+    if (std::strncmp(option, name, size) || (option[size] != '=')) return NULL;
+
+    return &option[size + 1];
+}
+
+// Run counts are saturating 16-bit counters, returns true on success
+bool parseRunCount(const char *value, u32 &runs) {
+    char *end;
+
+    const auto count = std::strtoul(value, &end, 0);
+
+    if ((*end != '\0') || (count == 0) || (count > 0xFFFF)) {
+        std::printf("Invalid run count \"%s\"\n", value);
+
+        return false;
+    }
+
+    runs = count;
+
+    return true;
+}
+
+// Returns true on success
+bool parseOption(const char *option) {
+    if (const auto value = getValue(option, "--cpu")) {
+        if (!std::strcmp(value, "interpreter")) {
+            cpuEngine = CPUEngine::Interpreter;
+        } else if (!std::strcmp(value, "cached")) {
+            cpuEngine = CPUEngine::CachedInterpreter;
+        } else if (!std::strcmp(value, "jit")) {
+            cpuEngine = CPUEngine::JIT;
+        } else if (!std::strcmp(value, "tiered")) {
+            cpuEngine = CPUEngine::Tiered;
+        } else {
+            std::printf("Unknown CPU engine \"%s\"\n", value);
+
+            return false;
+        }
+
+        return true;
+    }
+
+    if (const auto value = getValue(option, "--timing")) {
+        if (!std::strcmp(value, "accurate")) {
+            timing = Timing::Accurate;
+        } else if (!std::strcmp(value, "fast")) {
+            timing = Timing::Fast;
+        } else if (!std::strcmp(value, "instant")) {
+            timing = Timing::Instant;
+        } else {
+            std::printf("Unknown timing profile \"%s\"\n", value);
+
+            return false;
+        }
+
+        return true;
+    }
+
+    if (const auto value = getValue(option, "--slice")) {
+        char *end;
+
+        maxSliceCycles = std::strtoll(value, &end, 0);
+
+        if ((*end != '\0') || (maxSliceCycles <= 0)) {
+            std::printf("Invalid slice length \"%s\"\n", value);
+
+            return false;
+        }
+
+        return true;
+    }
+
+    if (const auto value = getValue(option, "--tier-cached")) return parseRunCount(value, tierCachedRuns);
+    if (const auto value = getValue(option, "--tier-jit")) return parseRunCount(value, tierJITRuns);
+
+    if (const auto value = getValue(option, "--frames")) {
+        char *end;
+
+        maxFrames = std::strtoull(value, &end, 0);
+
+        if (*end != '\0') {
+            std::printf("Invalid frame count \"%s\"\n", value);
+
+            return false;
+        }
+
+        return true;
+    }
+
+    if (const auto value = getValue(option, "--cycles")) {
+        char *end;
+
+        maxCycles = std::strtoll(value, &end, 0);
+
+        if ((*end != '\0') || (maxCycles < 0)) {
+            std::printf("Invalid cycle budget \"%s\"\n", value);
+
+            return false;
+        }
+
+        return true;
+    }
+
+    if (const auto value = getValue(option, "--block-cache")) {
+        blockCachePath = value;
+
+        return true;
+    }
+
+    if (const auto value = getValue(option, "--dump")) {
+        dumpPath = value;
+
+        return true;
+    }
+
+    if (const auto value = getValue(option, "--guest")) {
+        guestPath = value;
+
+        return true;
+    }
+
+    if (const auto value = getValue(option, "--guest-addr")) {
+        char *end;
+
+        guestAddr = std::strtoul(value, &end, 0);
+
+        if (*end != '\0') {
+            std::printf("Invalid guest load address \"%s\"\n", value);
+
+            return false;
+        }
+
+        return true;
+    }
+
+    if (!std::strcmp(option, "--fastmem")) {
+        fastmem = true;
+
+        return true;
+    }
+
+    if (!std::strcmp(option, "--headless")) {
+        headless = true;
+
+        return true;
+    }
+
+    if (!std::strcmp(option, "--lockstep")) {
+        lockstep = true;
+
+        return true;
+    }
+
+    if (!std::strcmp(option, "--me-thread")) {
+        meThread = true;
+
+        return true;
+    }
+
+    std::printf("Unknown option \"%s\"\n", option);
+
+    return false;
+}
+
+void printOptions() {
+    std::puts("Options:");
+    std::puts("  --block-cache=<path>          Load block profiles from path and save them on exit, see --cpu=tiered");
+    std::puts("  --cpu=interpreter|cached|jit|tiered  CPU engine (default: interpreter)");
+    std::puts("  --cycles=<cycles>             Stop after this many CPU cycles");
+    std::puts("  --dump=<path>                 Write the last frame to path as raw RGBA8888 on exit");
+    std::puts("  --fastmem                     Map guest RAM into the host address space for JIT loads/stores");
+    std::puts("  --frames=<count>              Stop after this many frames");
+    std::puts("  --guest=<path>                Run a raw Allegrex binary headless instead of booting");
+    std::puts("  --guest-addr=<addr>           Load and entry address of the guest binary (default: 0x08800000)");
+    std::puts("  --headless                    Run without a window and without VSYNC throttling");
+    std::puts("  --lockstep                    Check every block of the block engines against the interpreter");
+    std::puts("  --me-thread                   Run the Media Engine on its own host thread");
+    std::puts("  --slice=<cycles>              Longest run slice between scheduler events (default: 32768)");
+    std::puts("  --tier-cached=<runs>          Runs before the tiered engine caches a block (default: 2)");
+    std::puts("  --tier-jit=<runs>             Runs of a cached block before the tiered engine compiles it (default: 64)");
+    std::puts("  --timing=accurate|fast|instant  Peripheral completion delays (default: accurate)");
+}
+
+}
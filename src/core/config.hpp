@@ -0,0 +1,56 @@
+/*
+ * ChiSP is a PlayStation Portable emulator written in C++.
+ * Copyright (C) 2023  noumidev
+ */
+
+#pragma once
+
+#include "../common/types.hpp"
+
+namespace psp::config {
+
+enum class CPUEngine {
+    Interpreter,
+    CachedInterpreter,
+    JIT,
+    Tiered, // Interpreter for cold code, cached interpreter for warm blocks, JIT for hot blocks
+};
+
+// Completion delays of peripherals
+enum class Timing {
+    Accurate,
+    Fast,    // Delays are divided by 16
+    Instant, // Operations complete on the next cycle
+};
+
+extern CPUEngine cpuEngine;
+extern Timing timing;
+
+extern bool fastmem;
+extern bool meThread;
+extern bool headless;
+extern bool lockstep;
+
+// Run limits, 0 means no limit
+extern u64 maxFrames;
+extern i64 maxCycles;
+
+extern const char *dumpPath; // Final frame is written here if not NULL
+
+extern const char *blockCachePath; // Block profiles are loaded from and saved to this file if not NULL
+
+// Raw Allegrex binary that is run instead of the boot ROM if not NULL
+extern const char *guestPath;
+extern u32 guestAddr;
+
+extern i64 maxSliceCycles;
+
+// Tiered engine promotion thresholds, in block runs
+extern u32 tierCachedRuns;
+extern u32 tierJITRuns;
+
+bool parseOption(const char *option);
+
+void printOptions();
+
+}
@@ -302,6 +302,8 @@ void cmdDecryptPrivate() {
         // TODO: verify CMAC?
 
         std::memcpy(dstBuffer, data, mHeader.dataLength);
+
+        memory::invalidateCode(dstAddr, mHeader.dataLength);
     } else if (mHeader.version == 1) {
         std::puts("Unimplemented ECDSA");
 
@@ -351,6 +353,8 @@ void cmdDecryptAESKeystore() {
     //}
 
     std::memcpy(dstBuffer, data, dataLength);
+
+    memory::invalidateCode(dstAddr, dataLength);
 }
 
 void cmdGenerateSHA1() {
@@ -366,6 +370,8 @@ void cmdGenerateSHA1() {
     std::printf("Data length: 0x%X\n", dataLength);
 
     kirkGenerateSHA1(&srcBuffer[4], dstBuffer, dataLength);
+
+    memory::invalidateCode(dstAddr, 20); // SHA-1 digest
 }
 
 void doCommand() {
@@ -435,7 +441,7 @@ void write(u32 addr, u32 data) {
             if (data & 1) {
                 status &= ~STATUS::PHASE_1_DONE;
 
-                scheduler::addEvent(idFinishPhase1, 0, KIRK_OP_CYCLES);
+                scheduler::addDeviceEvent(idFinishPhase1, 0, KIRK_OP_CYCLES);
             }
 
             assert(!(data & 2));
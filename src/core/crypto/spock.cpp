@@ -127,6 +127,8 @@ void doCommand() {
                 *(u32 *)(addr + 64) = 1;
                 *(u32 *)(addr + 68) = 0;
 
+                memory::invalidateCode(taddr[0], 88);
+
                 ata::finishSCSICommand();
             }
             break;
@@ -127,7 +127,7 @@ void doTransfer(int chnID) {
         dstAddr += dstOffset;
     }
 
-    scheduler::addEvent(idFinishTransfer, chnID, 8 * chn.length);
+    scheduler::addDeviceEvent(idFinishTransfer, chnID, 8 * chn.length);
 }
 
 void init() {
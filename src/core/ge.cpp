@@ -1489,12 +1489,12 @@ void executeDisplayList() {
 
                 isEnd = true;
 
-                scheduler::addEvent(idSendIRQ, CMDSTATUS::END, (count) ? 5 * count : 128);
+                scheduler::addDeviceEvent(idSendIRQ, CMDSTATUS::END, (count) ? 5 * count : 128);
                 break;
             case CMD_FINISH:
                 if (ENABLE_DEBUG_PRINT) std::printf("[GE      ] [0x%08X] FINISH\n", cpc);
 
-                scheduler::addEvent(idSendIRQ, CMDSTATUS::FINISH, (count) ? 5 * count : 128);
+                scheduler::addDeviceEvent(idSendIRQ, CMDSTATUS::FINISH, (count) ? 5 * count : 128);
                 break;
             case CMD_BASE:
                 regs.base = (instr & 0xFF0000) << 8;
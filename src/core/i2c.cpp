@@ -117,7 +117,7 @@ void doCommand() {
             exit(0);
     }
     
-    scheduler::addEvent(idFinishTransfer, 0, I2C_OP_CYCLES);
+    scheduler::addDeviceEvent(idFinishTransfer, 0, I2C_OP_CYCLES);
 }
 
 u8 getRxQueue() {
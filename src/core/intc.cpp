@@ -34,6 +34,11 @@ void meCheckInterrupt() {
     meSetIRQPending((unmaskedflags[1][0] & mask[1][0]) | (unmaskedflags[1][1] & mask[1][1]) | (unmaskedflags[1][2] & mask[1][2]));
 }
 
+void checkInterrupts() {
+    checkInterrupt();
+    meCheckInterrupt();
+}
+
 u32 read(int cpuID, u32 addr) {
     switch ((INTCRegs)addr) {
         case INTCRegs::UNMASKEDFLAGS1:
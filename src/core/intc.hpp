@@ -34,4 +34,7 @@ void meSendIRQ(InterruptSource irqSource);
 
 void clearIRQ(InterruptSource irqSource);
 
+// Updates the interrupt lines of both cores
+void checkInterrupts();
+
 }
@@ -8,9 +8,16 @@
 #include <array>
 #include <cassert>
 #include <cstdio>
+#include <atomic>
 #include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "ata.hpp"
+#include "config.hpp"
 #include "ddr.hpp"
 #include "display.hpp"
 #include "dmacplus.hpp"
@@ -20,8 +27,10 @@
 #include "intc.hpp"
 #include "i2c.hpp"
 #include "nand.hpp"
+#include "psp.hpp"
 #include "syscon.hpp"
 #include "systime.hpp"
+#include "allegrex/blockcache.hpp"
 #include "crypto/kirk.hpp"
 #include "crypto/spock.hpp"
 #include "../common/file.hpp"
@@ -31,58 +40,463 @@ namespace psp::memory {
 constexpr auto CPUID_CPU = 0;
 constexpr auto CPUID_ME  = 1;
 
-// PSP system memory
-std::array<u8, (u64)MemorySize::BootROM> bootROM;
-std::array<u8, (u64)MemorySize::SPRAM> spram;
-std::array<u8, (u64)MemorySize::EDRAM> edram, sharedRAM, meSPRAM;
-std::array<u8, (u64)MemorySize::DRAM>  dram;
+// RAM layout, offsets are page-aligned so that fastmem views can map them
+enum class RAMOffset {
+    DRAM = 0,
+    EDRAM = DRAM + (u32)MemorySize::DRAM,
+    SharedRAM = EDRAM + (u32)MemorySize::EDRAM,
+    MESPRAM = SharedRAM + (u32)MemorySize::EDRAM,
+    SPRAM = MESPRAM + (u32)MemorySize::EDRAM,
+    BootROM = SPRAM + (u32)MemorySize::SPRAM,
+    Size = BootROM + (u32)MemorySize::BootROM,
+};
+
+// PSP system memory, backed by ramFd if fastmem is enabled
+u8 *ram;
+u8 *bootROM, *spram, *edram, *sharedRAM, *meSPRAM, *dram;
+
+int ramFd = -1;
 
-u8 *resetVector = bootROM.data();
+u8 *resetVector;
 u32 resetSize = (u32)MemorySize::BootROM;
 
 u32 cpufreq[2] = {0x1FF01FF, 0x1FF01FF}, busfreq[2] = {0x1FF01FF, 0x1FF01FF};
 
+constexpr u32 PAGE_SHIFT = 12;
+constexpr u32 PAGE_SIZE  = 1 << PAGE_SHIFT;
+constexpr u32 PAGE_COUNT = (u32)MemoryBase::PAddrSpace >> PAGE_SHIFT;
+
+using PageTable = std::array<u8 *, PAGE_COUNT>;
+
+// Host pointers to RAM-backed pages, NULL if the page is handled by a device
+PageTable pageTable, mePageTable;
+
+// Host mirrors of the physical address space, NULL if fastmem is disabled
+u8 *fastmemBase[2]; // CPU, ME
+
+constexpr u32 RAM_PAGE_COUNT = (u32)RAMOffset::Size >> PAGE_SHIFT;
+
+// Number of device accesses made by each core, in total and per 1 MiB region
+u64 ioCount[2];
+u64 ioRegionCount[2][(u32)MemoryBase::PAddrSpace >> IO_REGION_SHIFT];
+
+// Serializes device accesses if the ME runs on its own thread
+std::recursive_mutex ioMutex;
+
+// Set if a RAM page holds decoded blocks, indexed by RAM page
+std::vector<std::atomic<u8>> codePages(RAM_PAGE_COUNT);
+
+// Guards code page flags and aliases, blocks are decoded by both cores
+std::mutex codeMutex;
+
+// Guest pages that map each RAM page, (CPU ID << 31) | page
+std::vector<std::vector<u32>> codeAliases(RAM_PAGE_COUNT);
+
 // Returns true if addr is in the range base,(base + size)
 bool inRange(u64 addr, u64 base, u64 size) {
     return (addr >= base) && (addr < (base + size));
 }
 
+// Maps the range base,(base + size) to mem, mirrored every memSize bytes. Pages that are already mapped are kept
+void mapPages(PageTable &table, u32 base, u32 size, u8 *mem, u32 memSize) {
+    assert(!(base & (PAGE_SIZE - 1)) && !(size & (PAGE_SIZE - 1)) && (memSize >= PAGE_SIZE));
+
+    for (u32 addr = base; addr < (base + size); addr += PAGE_SIZE) {
+        auto &page = table[addr >> PAGE_SHIFT];
+
+        if (page == NULL) {
+            page = &mem[addr & (memSize - 1)];
+        }
+    }
+}
+
+/*
+ * Mirrors a page table in a fastmem view. Mapped pages alias the RAM file,
+ * device pages are left inaccessible so that accesses to them fault.
+ * Every range is replaced in place, RAM pages never become inaccessible.
+ */
+void mapFastmem(u8 *base, const PageTable &table) {
+    for (u32 page = 0; page < PAGE_COUNT;) {
+        const auto mem = table[page];
+
+        u32 count = 1;
+
+        if (mem == NULL) {
+            while (((page + count) < PAGE_COUNT) && (table[page + count] == NULL)) count++;
+        } else {
+            while (((page + count) < PAGE_COUNT) && (table[page + count] == &mem[count * PAGE_SIZE])) count++;
+        }
+
+        void *view;
+
+        if (mem == NULL) {
+            view = mmap(&base[page << PAGE_SHIFT], count << PAGE_SHIFT, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+        } else {
+            view = mmap(&base[page << PAGE_SHIFT], count << PAGE_SHIFT, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, ramFd, mem - ram);
+        }
+
+        if (view == MAP_FAILED) {
+            std::printf("[Memory  ] Unable to map fastmem page 0x%08X\n", page << PAGE_SHIFT);
+
+            exit(0);
+        }
+
+        page += count;
+    }
+}
+
+// Mapping order follows the priority of the old range checks
+void mapCPUPages() {
+    pageTable.fill(NULL);
+
+    mapPages(pageTable, (u32)MemoryBase::SPRAM, (u32)MemorySize::SPRAM, spram, (u32)MemorySize::SPRAM);
+    mapPages(pageTable, (u32)MemoryBase::EDRAM, (u32)MemorySize::EDRAM, edram, (u32)MemorySize::EDRAM);
+    mapPages(pageTable, (u32)MemoryBase::DRAM, (u32)MemorySize::DRAM, dram, (u32)MemorySize::DRAM);
+    mapPages(pageTable, (u32)MemoryBase::BootROM, resetSize, resetVector, resetSize);
+    mapPages(pageTable, (u32)MemoryBase::SharedRAM, (u32)MemorySize::EDRAM, sharedRAM, (u32)MemorySize::EDRAM);
+
+    if (fastmemBase[CPUID_CPU] != NULL) mapFastmem(fastmemBase[CPUID_CPU], pageTable);
+}
+
+void mapMEPages() {
+    mePageTable.fill(NULL);
+
+    mapPages(mePageTable, (u32)MemoryBase::MESPRAM, (u32)MemorySize::EDRAM, meSPRAM, (u32)MemorySize::EDRAM);
+    mapPages(mePageTable, (u32)MemoryBase::DRAM, (u32)MemorySize::DRAM, dram, (u32)MemorySize::DRAM);
+    mapPages(mePageTable, (u32)MemoryBase::BootROM, (u32)MemorySize::EDRAM, sharedRAM, (u32)MemorySize::EDRAM);
+
+    if (fastmemBase[CPUID_ME] != NULL) mapFastmem(fastmemBase[CPUID_ME], mePageTable);
+}
+
+std::unique_lock<std::recursive_mutex> lockIO() {
+    if (!config::meThread) return {};
+
+    return std::unique_lock(ioMutex);
+}
+
+// Rebuilds the guest page aliases of every RAM page
+void mapCodeAliases() {
+    std::lock_guard lock(codeMutex);
+
+    for (auto &aliases : codeAliases) aliases.clear();
+
+    for (u32 page = 0; page < PAGE_COUNT; page++) {
+        if (const auto mem = pageTable[page]) codeAliases[(mem - ram) >> PAGE_SHIFT].push_back((CPUID_CPU << 31) | page);
+        if (const auto mem = mePageTable[page]) codeAliases[(mem - ram) >> PAGE_SHIFT].push_back((CPUID_ME << 31) | page);
+    }
+}
+
+// Changes the protection of all fastmem pages aliasing a RAM page
+void protectCodePage(u32 ramPage, int prot) {
+    for (const auto alias : codeAliases[ramPage]) {
+        const auto base = fastmemBase[alias >> 31];
+
+        if (base == NULL) continue;
+
+        if (mprotect(&base[(alias & ~(1U << 31)) << PAGE_SHIFT], PAGE_SIZE, prot) < 0) {
+            std::printf("[Memory  ] Unable to protect fastmem page 0x%08X\n", (alias & ~(1U << 31)) << PAGE_SHIFT);
+
+            exit(0);
+        }
+    }
+}
+
+// Write-protects the fastmem aliases of all code pages, views are remapped read/write
+void protectCodePages() {
+    if ((fastmemBase[CPUID_CPU] == NULL) && (fastmemBase[CPUID_ME] == NULL)) return;
+
+    std::lock_guard lock(codeMutex);
+
+    for (u32 ramPage = 0; ramPage < RAM_PAGE_COUNT; ramPage++) {
+        if (codePages[ramPage]) protectCodePage(ramPage, PROT_READ);
+    }
+}
+
+// Drops the blocks of both cores on a RAM page
+void invalidateCodePage(u32 ramPage) {
+    std::lock_guard lock(codeMutex);
+
+    if (!codePages[ramPage].exchange(false)) return;
+
+    for (const auto alias : codeAliases[ramPage]) {
+        allegrex::blockcache::invalidatePage(alias >> 31, (alias & ~(1U << 31)) << PAGE_SHIFT);
+    }
+
+    protectCodePage(ramPage, PROT_READ | PROT_WRITE);
+}
+
+// Checks a RAM write for self-modifying code
+inline void checkCode(const u8 *mem) {
+    const auto ramPage = (u32)((mem - ram) >> PAGE_SHIFT);
+
+    if (codePages[ramPage].load(std::memory_order_relaxed)) invalidateCodePage(ramPage);
+}
+
+// Undo log of RAM writes, only recorded while the lock-step checker runs a block
+std::vector<JournalEntry> journal;
+
+bool isJournaling = false;
+
+inline void journalWrite(u8 *mem, const void *data, u32 size) {
+    if (!isJournaling) [[likely]] return;
+
+    auto &entry = journal.emplace_back();
+
+    entry.mem = mem;
+    entry.size = size;
+
+    std::memcpy(entry.oldData, mem, size);
+    std::memcpy(entry.newData, data, size);
+}
+
+// Allocates RAM from a memory file and reserves the fastmem views, returns false on failure
+bool initFastmem() {
+#ifdef __linux__
+    if (sysconf(_SC_PAGESIZE) > PAGE_SIZE) {
+        std::puts("[Memory  ] Host page size is too large for fastmem");
+
+        return false;
+    }
+
+    ramFd = memfd_create("ChiSP RAM", 0);
+
+    if (ramFd < 0) {
+        std::puts("[Memory  ] Unable to create RAM file");
+
+        return false;
+    }
+
+    if (ftruncate(ramFd, (u64)RAMOffset::Size) < 0) {
+        std::puts("[Memory  ] Unable to resize RAM file");
+
+        close(ramFd);
+
+        ramFd = -1;
+
+        return false;
+    }
+
+    void *mem = mmap(NULL, (u64)RAMOffset::Size, PROT_READ | PROT_WRITE, MAP_SHARED, ramFd, 0);
+
+    if (mem == MAP_FAILED) {
+        std::puts("[Memory  ] Unable to map RAM file");
+
+        close(ramFd);
+
+        ramFd = -1;
+
+        return false;
+    }
+
+    ram = (u8 *)mem;
+
+    for (auto &base : fastmemBase) {
+        void *view = mmap(NULL, (u64)MemoryBase::PAddrSpace, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if (view == MAP_FAILED) {
+            std::puts("[Memory  ] Unable to reserve fastmem address space");
+
+            exit(0);
+        }
+
+        base = (u8 *)view;
+    }
+
+    return true;
+#else
+    std::puts("[Memory  ] Fastmem is not supported on this host");
+
+    return false;
+#endif
+}
+
 void init(const char *bootPath) {
-    std::printf("[Memory  ] Loading boot ROM \"%s\"\n", bootPath);
-    assert(loadFile(bootPath, bootROM.data(), (u64)MemorySize::BootROM));
+    if (!config::fastmem || !initFastmem()) {
+        void *mem = mmap(NULL, (u64)RAMOffset::Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (mem == MAP_FAILED) {
+            std::puts("[Memory  ] Unable to allocate RAM");
+
+            exit(0);
+        }
+
+        ram = (u8 *)mem;
+    }
+
+    dram = &ram[(u32)RAMOffset::DRAM];
+    edram = &ram[(u32)RAMOffset::EDRAM];
+    sharedRAM = &ram[(u32)RAMOffset::SharedRAM];
+    meSPRAM = &ram[(u32)RAMOffset::MESPRAM];
+    spram = &ram[(u32)RAMOffset::SPRAM];
+    bootROM = &ram[(u32)RAMOffset::BootROM];
+
+    resetVector = bootROM;
+
+    // The benchmarks run without a boot ROM
+    if (bootPath != NULL) {
+        std::printf("[Memory  ] Loading boot ROM \"%s\"\n", bootPath);
+        assert(loadFile(bootPath, bootROM, (u64)MemorySize::BootROM));
+    }
+
+    mapCPUPages();
+    mapMEPages();
+    mapCodeAliases();
+
+    if (fastmemBase[CPUID_CPU] != NULL) std::puts("[Memory  ] Using fastmem");
 
     std::puts("[Memory  ] OK");
 }
 
-u8 *getMemoryPointer(u32 addr) {
+u8 *getFastmemBase(bool isME) {
+    return fastmemBase[isME];
+}
+
+bool isFastmemAddress(const void *addr) {
+    for (const auto base : fastmemBase) {
+        if ((base != NULL) && ((const u8 *)addr >= base) && ((const u8 *)addr < &base[(u32)MemoryBase::PAddrSpace])) return true;
+    }
+
+    return false;
+}
+
+// Returns a host pointer to addr, NULL if addr isn't RAM-backed
+u8 *getPage(const PageTable &table, u32 addr) {
+    const auto page = table[addr >> PAGE_SHIFT];
+
+    if (page == NULL) return NULL;
+
+    return &page[addr & (PAGE_SIZE - 1)];
+}
+
+// Bookkeeping done before every device access
+void beginIO(int cpuID, u32 addr) {
+    ioCount[cpuID]++;
+    ioRegionCount[cpuID][addr >> IO_REGION_SHIFT]++;
+
+    psp::catchUp(cpuID);
+}
+
+void beginJournal() {
+    journal.clear();
+
+    isJournaling = true;
+}
+
+const std::vector<JournalEntry> &endJournal() {
+    isJournaling = false;
+
+    return journal;
+}
+
+void rollbackJournal(const std::vector<JournalEntry> &entries) {
+    for (auto entry = entries.rbegin(); entry != entries.rend(); entry++) {
+        std::memcpy(entry->mem, entry->oldData, entry->size);
+
+        checkCode(entry->mem);
+    }
+}
+
+u64 getIOCount(bool isME) {
+    return ioCount[isME];
+}
+
+u64 getIORegionCount(u32 addr) {
+    const auto idx = (addr & ((u32)MemoryBase::PAddrSpace - 1)) >> IO_REGION_SHIFT;
+
+    return ioRegionCount[CPUID_CPU][idx] + ioRegionCount[CPUID_ME][idx];
+}
+
+void markCode(bool isME, u32 addr) {
     addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
 
-    if (inRange(addr, (u64)MemoryBase::EDRAM, (u64)MemorySize::EDRAM)) {
-        return &edram[addr & ((u32)MemorySize::EDRAM - 1)];
-    } else if (inRange(addr, (u64)MemoryBase::DRAM, (u64)MemorySize::DRAM)) {
-        return &dram[addr & ((u32)MemorySize::DRAM - 1)];
-    } else if (inRange(addr, (u64)MemoryBase::SharedRAM, (u64)MemorySize::EDRAM)) {
-        return &sharedRAM[addr & ((u32)MemorySize::EDRAM - 1)];
-    } else {
-        switch (addr) {
-            default:
-                std::printf("Unhandled memory region @ 0x%08X\n", addr);
+    const auto mem = getPage(isME ? mePageTable : pageTable, addr);
 
-                exit(0);
-        }
+    if (mem == NULL) return;
+
+    const auto ramPage = (u32)((mem - ram) >> PAGE_SHIFT);
+
+    if (codePages[ramPage].load(std::memory_order_relaxed)) return;
+
+    std::lock_guard lock(codeMutex);
+
+    if (codePages[ramPage].exchange(true)) return;
+
+    protectCodePage(ramPage, PROT_READ);
+}
+
+void invalidateCode(u32 addr, u32 size) {
+    addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
+
+    if (size == 0) return;
+
+    const auto end = (u64)addr + size;
+
+    for (u64 page = addr & ~(PAGE_SIZE - 1); page < end; page += PAGE_SIZE) {
+        if (page >= (u64)MemoryBase::PAddrSpace) break;
+
+        if (const auto mem = getPage(pageTable, page)) checkCode(mem);
+    }
+}
+
+u8 *getMemoryPointer(u32 addr) {
+    addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
+
+    if (const auto mem = getPage(pageTable, addr)) {
+        return mem;
     }
+
+    std::printf("Unhandled memory region @ 0x%08X\n", addr);
+
+    exit(0);
+}
+
+// The CPU's reset vector window is remapped when the boot ROM is unmapped
+bool isRemappable(bool isME, u32 addr) {
+    return !isME && inRange(addr, (u64)MemoryBase::BootROM, (u64)MemorySize::EDRAM);
+}
+
+u8 *getFixedPointer(bool isME, u32 addr) {
+    addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
+
+    if (isRemappable(isME, addr)) return NULL;
+
+    return getPage(isME ? mePageTable : pageTable, addr);
+}
+
+u8 *getMappedPointer(bool isME, u32 addr) {
+    addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
+
+    return getPage(isME ? mePageTable : pageTable, addr);
+}
+
+bool isFixedDevice(bool isME, u32 addr) {
+    addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
+
+    if (isRemappable(isME, addr)) return false;
+
+    return getPage(isME ? mePageTable : pageTable, addr) == NULL;
+}
+
+void writeFixed(u8 *mem, const void *data, u32 size) {
+    journalWrite(mem, data, size);
+
+    std::memcpy(mem, data, size);
+
+    checkCode(mem);
 }
 
 u8 read8(u32 addr) {
     addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
 
-    if (inRange(addr, (u64)MemoryBase::SPRAM, (u64)MemorySize::SPRAM)) {
-        return spram[addr & ((u32)MemorySize::SPRAM - 1)];
-    } else if (inRange(addr, (u64)MemoryBase::EDRAM, (u64)MemorySize::EDRAM)) {
-        return edram[addr & ((u32)MemorySize::EDRAM - 1)];
-    } else if (inRange(addr, (u64)MemoryBase::DRAM, (u64)MemorySize::DRAM)) {
-        return dram[addr & ((u32)MemorySize::DRAM - 1)];
-    } else if (inRange(addr, (u64)MemoryBase::MS, (u64)MemorySize::MS)) {
+    if (const auto mem = getPage(pageTable, addr)) {
+        return *mem;
+    }
+
+    beginIO(CPUID_CPU, addr);
+
+    const auto ioLock = lockIO();
+
+    if (inRange(addr, (u64)MemoryBase::MS, (u64)MemorySize::MS)) {
         std::printf("[MS      ] Unhandled read8 @ 0x%08X\n", addr);
 
         return 0;
@@ -92,10 +506,6 @@ u8 read8(u32 addr) {
         return 0;
     } else if (inRange(addr, (u64)MemoryBase::ATA1, (u64)MemorySize::ATA1)) {
         return ata::ata1Read8(addr);
-    } else if (inRange(addr, (u64)MemoryBase::BootROM, resetSize)) {
-        return resetVector[addr & (resetSize - 1)];
-    } else if (inRange(addr, (u64)MemoryBase::SharedRAM, (u64)MemorySize::EDRAM)) {
-        return sharedRAM[addr & ((u32)MemorySize::EDRAM - 1)];
     } else {
         switch (addr) {
             default:
@@ -109,15 +519,18 @@ u8 read8(u32 addr) {
 u16 read16(u32 addr) {
     addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
 
-    u16 data;
+    if (const auto mem = getPage(pageTable, addr)) {
+        u16 data;
+        std::memcpy(&data, mem, sizeof(u16));
 
-    if (inRange(addr, (u64)MemoryBase::SPRAM, (u64)MemorySize::SPRAM)) {
-        std::memcpy(&data, &spram[addr & ((u32)MemorySize::SPRAM - 1)], sizeof(u16));
-    } else if (inRange(addr, (u64)MemoryBase::EDRAM, (u64)MemorySize::EDRAM)) {
-        std::memcpy(&data, &edram[addr & ((u32)MemorySize::EDRAM - 1)], sizeof(u16));
-    } else if (inRange(addr, (u64)MemoryBase::DRAM, (u64)MemorySize::DRAM)) {
-        std::memcpy(&data, &dram[addr & ((u32)MemorySize::DRAM - 1)], sizeof(u16));
-    } else if (inRange(addr, (u64)MemoryBase::MS, (u64)MemorySize::MS)) {
+        return data;
+    }
+
+    beginIO(CPUID_CPU, addr);
+
+    const auto ioLock = lockIO();
+
+    if (inRange(addr, (u64)MemoryBase::MS, (u64)MemorySize::MS)) {
         std::printf("[MS      ] Unhandled read16 @ 0x%08X\n", addr);
 
         return 0;
@@ -127,10 +540,6 @@ u16 read16(u32 addr) {
         return 0;
     } else if (inRange(addr, (u64)MemoryBase::ATA1, (u64)MemorySize::ATA1)) {
         return ata::ata1Read16(addr);
-    } else if (inRange(addr, (u64)MemoryBase::BootROM, resetSize)) {
-        std::memcpy(&data, &resetVector[addr & (resetSize - 1)], sizeof(u16));
-    } else if (inRange(addr, (u64)MemoryBase::SharedRAM, (u64)MemorySize::EDRAM)) {
-        std::memcpy(&data, &sharedRAM[addr & ((u32)MemorySize::EDRAM - 1)], sizeof(u16));
     } else {
         switch (addr) {
             case 0x11800000: // IPL checks for string "MS"
@@ -142,24 +551,25 @@ u16 read16(u32 addr) {
                 exit(0);
         }
     }
-
-    return data;
 }
 
 u32 read32(u32 addr) {
-    //if (addr == 0x880402EC) writeFile("ram.bin", dram.data(), (u64)MemorySize::DRAM);
+    //if (addr == 0x880402EC) writeFile("ram.bin", dram, (u64)MemorySize::DRAM);
 
     addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
 
-    u32 data;
+    if (const auto mem = getPage(pageTable, addr)) {
+        u32 data;
+        std::memcpy(&data, mem, sizeof(u32));
 
-    if (inRange(addr, (u64)MemoryBase::SPRAM, (u64)MemorySize::SPRAM)) {
-        std::memcpy(&data, &spram[addr & ((u32)MemorySize::SPRAM - 1)], sizeof(u32));
-    } else if (inRange(addr, (u64)MemoryBase::EDRAM, (u64)MemorySize::EDRAM)) {
-        std::memcpy(&data, &edram[addr & ((u32)MemorySize::EDRAM - 1)], sizeof(u32));
-    } else if (inRange(addr, (u64)MemoryBase::DRAM, (u64)MemorySize::DRAM)) {
-        std::memcpy(&data, &dram[addr & ((u32)MemorySize::DRAM - 1)], sizeof(u32));
-    } else if (inRange(addr, (u64)MemoryBase::MEMPROT, (u64)MemorySize::MEMPROT)) {
+        return data;
+    }
+
+    beginIO(CPUID_CPU, addr);
+
+    const auto ioLock = lockIO();
+
+    if (inRange(addr, (u64)MemoryBase::MEMPROT, (u64)MemorySize::MEMPROT)) {
         std::printf("[MEMPROT ] Unhandled read @ 0x%08X\n", addr);
 
         return 0;
@@ -237,10 +647,6 @@ u32 read32(u32 addr) {
         return syscon::readSerial(addr);
     } else if (inRange(addr, (u64)MemoryBase::Display, (u64)MemorySize::Display)) {
         return display::read(addr);
-    } else if (inRange(addr, (u64)MemoryBase::BootROM, resetSize)) {
-        std::memcpy(&data, &resetVector[addr & (resetSize - 1)], sizeof(u32));
-    } else if (inRange(addr, (u64)MemoryBase::SharedRAM, (u64)MemorySize::EDRAM)) {
-        std::memcpy(&data, &sharedRAM[addr & ((u32)MemorySize::EDRAM - 1)], sizeof(u32));
     } else if (inRange(addr, (u64)MemoryBase::NANDBuffer, (u64)MemorySize::NANDBuffer)) {
         return nand::readBuffer32(addr);
     } else {
@@ -280,29 +686,31 @@ u32 read32(u32 addr) {
                 exit(0);
         }
     }
-
-    return data;
 }
 
 void write8(u32 addr, u8 data) {
     addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
 
-    if (inRange(addr, (u64)MemoryBase::SPRAM, (u64)MemorySize::SPRAM)) {
-        spram[addr & ((u32)MemorySize::SPRAM - 1)] = data;
-    } else if (inRange(addr, (u64)MemoryBase::EDRAM, (u64)MemorySize::EDRAM)) {
-        edram[addr & ((u32)MemorySize::EDRAM - 1)] = data;
-    } else if (inRange(addr, (u64)MemoryBase::DRAM, (u64)MemorySize::DRAM)) {
-        dram[addr & ((u32)MemorySize::DRAM - 1)] = data;
-    } else if (inRange(addr, (u64)MemoryBase::MS, (u64)MemorySize::MS)) {
+    if (const auto mem = getPage(pageTable, addr)) {
+        journalWrite(mem, &data, sizeof(u8));
+
+        *mem = data;
+
+        checkCode(mem);
+
+        return;
+    }
+
+    beginIO(CPUID_CPU, addr);
+
+    const auto ioLock = lockIO();
+
+    if (inRange(addr, (u64)MemoryBase::MS, (u64)MemorySize::MS)) {
         std::printf("[MS      ] Unhandled write8 @ 0x%08X = 0x%02X\n", addr, data);
     } else if (inRange(addr, (u64)MemoryBase::WLAN, (u64)MemorySize::WLAN)) {
         std::printf("[WLAN    ] Unhandled write8 @ 0x%08X = 0x%02X\n", addr, data);
     } else if (inRange(addr, (u64)MemoryBase::ATA1, (u64)MemorySize::ATA1)) {
         return ata::ata1Write8(addr, data);
-    } else if (inRange(addr, (u64)MemoryBase::BootROM, resetSize)) {
-        resetVector[addr & (resetSize - 1)] = data;
-    } else if (inRange(addr, (u64)MemoryBase::SharedRAM, (u64)MemorySize::EDRAM)) {
-        sharedRAM[addr & ((u32)MemorySize::EDRAM - 1)] = data;
     } else {
         switch (addr) {
             default:
@@ -316,22 +724,26 @@ void write8(u32 addr, u8 data) {
 void write16(u32 addr, u16 data) {
     addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
 
-    if (inRange(addr, (u64)MemoryBase::SPRAM, (u64)MemorySize::SPRAM)) {
-        std::memcpy(&spram[addr & ((u32)MemorySize::SPRAM - 1)], &data, sizeof(u16));
-    } else if (inRange(addr, (u64)MemoryBase::EDRAM, (u64)MemorySize::EDRAM)) {
-        std::memcpy(&edram[addr & ((u32)MemorySize::EDRAM - 1)], &data, sizeof(u16));
-    } else if (inRange(addr, (u64)MemoryBase::DRAM, (u64)MemorySize::DRAM)) {
-        std::memcpy(&dram[addr & ((u32)MemorySize::DRAM - 1)], &data, sizeof(u16));
-    } else if (inRange(addr, (u64)MemoryBase::MS, (u64)MemorySize::MS)) {
+    if (const auto mem = getPage(pageTable, addr)) {
+        journalWrite(mem, &data, sizeof(u16));
+
+        std::memcpy(mem, &data, sizeof(u16));
+
+        checkCode(mem);
+
+        return;
+    }
+
+    beginIO(CPUID_CPU, addr);
+
+    const auto ioLock = lockIO();
+
+    if (inRange(addr, (u64)MemoryBase::MS, (u64)MemorySize::MS)) {
         std::printf("[MS      ] Unhandled write16 @ 0x%08X = 0x%04X\n", addr, data);
     } else if (inRange(addr, (u64)MemoryBase::WLAN, (u64)MemorySize::WLAN)) {
         std::printf("[WLAN    ] Unhandled write16 @ 0x%08X = 0x%04X\n", addr, data);
     } else if (inRange(addr, (u64)MemoryBase::ATA1, (u64)MemorySize::ATA1)) {
         return ata::ata1Write16(addr, data);
-    } else if (inRange(addr, (u64)MemoryBase::BootROM, resetSize)) {
-        std::memcpy(&resetVector[addr & (resetSize - 1)], &data, sizeof(u16));
-    } else if (inRange(addr, (u64)MemoryBase::SharedRAM, (u64)MemorySize::EDRAM)) {
-        std::memcpy(&sharedRAM[addr & ((u32)MemorySize::EDRAM - 1)], &data, sizeof(u16));
     } else {
         switch (addr) {
             default:
@@ -345,13 +757,21 @@ void write16(u32 addr, u16 data) {
 void write32(u32 addr, u32 data) {
     addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
 
-    if (inRange(addr, (u64)MemoryBase::SPRAM, (u64)MemorySize::SPRAM)) {
-        std::memcpy(&spram[addr & ((u32)MemorySize::SPRAM - 1)], &data, sizeof(u32));
-    } else if (inRange(addr, (u64)MemoryBase::EDRAM, (u64)MemorySize::EDRAM)) {
-        std::memcpy(&edram[addr & ((u32)MemorySize::EDRAM - 1)], &data, sizeof(u32));
-    } else if (inRange(addr, (u64)MemoryBase::DRAM, (u64)MemorySize::DRAM)) {
-        std::memcpy(&dram[addr & ((u32)MemorySize::DRAM - 1)], &data, sizeof(u32));
-    } else if (inRange(addr, (u64)MemoryBase::MEMPROT, (u64)MemorySize::MEMPROT)) {
+    if (const auto mem = getPage(pageTable, addr)) {
+        journalWrite(mem, &data, sizeof(u32));
+
+        std::memcpy(mem, &data, sizeof(u32));
+
+        checkCode(mem);
+
+        return;
+    }
+
+    beginIO(CPUID_CPU, addr);
+
+    const auto ioLock = lockIO();
+
+    if (inRange(addr, (u64)MemoryBase::MEMPROT, (u64)MemorySize::MEMPROT)) {
         std::printf("[MEMPROT ] Unhandled write @ 0x%08X = 0x%08X\n", addr, data);
     } else if (inRange(addr, (u64)MemoryBase::SysCon, (u64)MemorySize::SysCon)) {
         return syscon::write(CPUID_CPU, addr, data);
@@ -395,6 +815,8 @@ void write32(u32 addr, u32 data) {
         std::printf("[POWERMAN] Unhandled write @ 0x%08X = 0x%08X\n", addr, data);
     } else if (inRange(addr, (u64)MemoryBase::UART0, (u64)MemorySize::UART)) {
         if (addr == (u32)MemoryBase::UART0) {
+            if (psp::isGuestExit(data)) return psp::exitGuest();
+
             std::putchar(data);
         } else {
             std::printf("[UART0   ] Unhandled write @ 0x%08X = 0x%08X\n", addr, data);
@@ -405,10 +827,6 @@ void write32(u32 addr, u32 data) {
         return syscon::writeSerial(addr, data);
     } else if (inRange(addr, (u64)MemoryBase::Display, (u64)MemorySize::Display)) {
         return display::write(addr, data);
-    } else if (inRange(addr, (u64)MemoryBase::BootROM, resetSize)) {
-        std::memcpy(&resetVector[addr & (resetSize - 1)], &data, sizeof(u32));
-    } else if (inRange(addr, (u64)MemoryBase::SharedRAM, (u64)MemorySize::EDRAM)) {
-        std::memcpy(&sharedRAM[addr & ((u32)MemorySize::EDRAM - 1)], &data, sizeof(u32));
     } else {
         switch (addr) {
             case 0x1C200000:
@@ -458,13 +876,19 @@ void read128(u32 addr, u8 *data) {
 
     addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
 
-    if (inRange(addr, (u64)MemoryBase::DRAM, (u64)MemorySize::DRAM)) {
-        std::memcpy(data, &dram[addr & ((u32)MemorySize::DRAM - 1)], 4 * sizeof(u32));
-    } else {
-        std::printf("Unhandled read128 @ 0x%08X\n", addr);
+    if (const auto mem = getPage(pageTable, addr)) {
+        std::memcpy(data, mem, 4 * sizeof(u32));
 
-        exit(0);
+        return;
     }
+
+    beginIO(CPUID_CPU, addr);
+
+    const auto ioLock = lockIO();
+
+    std::printf("Unhandled read128 @ 0x%08X\n", addr);
+
+    exit(0);
 }
 
 void write128(u32 addr, u8 *data) {
@@ -472,72 +896,84 @@ void write128(u32 addr, u8 *data) {
 
     addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
 
-    if (inRange(addr, (u64)MemoryBase::EDRAM, (u64)MemorySize::EDRAM)) {
-        std::memcpy(&edram[addr & ((u32)MemorySize::EDRAM - 1)], data, 4 * sizeof(u32));
-    } else if (inRange(addr, (u64)MemoryBase::DRAM, (u64)MemorySize::DRAM)) {
-        std::memcpy(&dram[addr & ((u32)MemorySize::DRAM - 1)], data, 4 * sizeof(u32));
-    } else {
-        std::printf("Unhandled write128 @ 0x%08X = 0x%08X%08X%08X%08X\n", addr, *(u32 *)&data[0], *(u32 *)&data[4], *(u32 *)&data[8], *(u32 *)&data[12]);
+    if (const auto mem = getPage(pageTable, addr)) {
+        journalWrite(mem, data, 4 * sizeof(u32));
+
+        std::memcpy(mem, data, 4 * sizeof(u32));
+
+        checkCode(mem);
 
-        exit(0);
+        return;
     }
+
+    beginIO(CPUID_CPU, addr);
+
+    const auto ioLock = lockIO();
+
+    std::printf("Unhandled write128 @ 0x%08X = 0x%08X%08X%08X%08X\n", addr, *(u32 *)&data[0], *(u32 *)&data[4], *(u32 *)&data[8], *(u32 *)&data[12]);
+
+    exit(0);
 }
 
 u8 meRead8(u32 addr) {
     addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
 
-    if (inRange(addr, (u64)MemoryBase::MESPRAM, (u64)MemorySize::EDRAM)) {
-        return meSPRAM[addr & ((u32)MemorySize::EDRAM - 1)];
-    } else if (inRange(addr, (u64)MemoryBase::DRAM, (u64)MemorySize::DRAM)) {
-        return dram[addr & ((u32)MemorySize::DRAM - 1)];
-    } else if (inRange(addr, (u64)MemoryBase::BootROM, (u64)MemorySize::EDRAM)) {
-        return sharedRAM[addr & ((u32)MemorySize::EDRAM - 1)];
-    } else {
-        switch (addr) {
-            default:
-                std::printf("Unhandled ME read8 @ 0x%08X\n", addr);
+    if (const auto mem = getPage(mePageTable, addr)) {
+        return *mem;
+    }
 
-                exit(0);
-        }
+    beginIO(CPUID_ME, addr);
+
+    const auto ioLock = lockIO();
+
+    switch (addr) {
+        default:
+            std::printf("Unhandled ME read8 @ 0x%08X\n", addr);
+
+            exit(0);
     }
 }
 
 u16 meRead16(u32 addr) {
     addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
 
-    u16 data;
+    if (const auto mem = getPage(mePageTable, addr)) {
+        u16 data;
+        std::memcpy(&data, mem, sizeof(u16));
 
-    if (inRange(addr, (u64)MemoryBase::MESPRAM, (u64)MemorySize::EDRAM)) {
-        std::memcpy(&data, &meSPRAM[addr & ((u32)MemorySize::EDRAM - 1)], sizeof(u16));
-    } else if (inRange(addr, (u64)MemoryBase::DRAM, (u64)MemorySize::DRAM)) {
-        std::memcpy(&data, &dram[addr & ((u32)MemorySize::DRAM - 1)], sizeof(u16));
-    } else if (inRange(addr, (u64)MemoryBase::BootROM, (u64)MemorySize::EDRAM)) {
-        std::memcpy(&data, &sharedRAM[addr & ((u32)MemorySize::EDRAM - 1)], sizeof(u16));
-    } else {
-        switch (addr) {
-            default:
-                std::printf("Unhandled ME read16 @ 0x%08X\n", addr);
-
-                exit(0);
-        }
+        return data;
     }
 
-    return data;
+    beginIO(CPUID_ME, addr);
+
+    const auto ioLock = lockIO();
+
+    switch (addr) {
+        default:
+            std::printf("Unhandled ME read16 @ 0x%08X\n", addr);
+
+            exit(0);
+    }
 }
 
 u32 meRead32(u32 addr) {
     addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
 
-    u32 data;
+    if (const auto mem = getPage(mePageTable, addr)) {
+        u32 data;
+        std::memcpy(&data, mem, sizeof(u32));
 
-    if (inRange(addr, (u64)MemoryBase::MESPRAM, (u64)MemorySize::EDRAM)) {
-        std::memcpy(&data, &meSPRAM[addr & ((u32)MemorySize::EDRAM - 1)], sizeof(u32));
-    } else if (inRange(addr, (u64)MemoryBase::VME0, (u64)MemorySize::VME0)) {
+        return data;
+    }
+
+    beginIO(CPUID_ME, addr);
+
+    const auto ioLock = lockIO();
+
+    if (inRange(addr, (u64)MemoryBase::VME0, (u64)MemorySize::VME0)) {
         std::printf("[VME     ] Unhandled read @ 0x%08X\n", addr);
 
         return 0;
-    } else if (inRange(addr, (u64)MemoryBase::DRAM, (u64)MemorySize::DRAM)) {
-        std::memcpy(&data, &dram[addr & ((u32)MemorySize::DRAM - 1)], sizeof(u32));
     } else if (inRange(addr, (u64)MemoryBase::MEMPROT, (u64)MemorySize::MEMPROT)) {
         std::printf("[MEMPROT ] Unhandled read @ 0x%08X\n", addr);
 
@@ -550,8 +986,6 @@ u32 meRead32(u32 addr) {
         std::printf("[VME     ] Unhandled read @ 0x%08X\n", addr);
 
         return 0;
-    } else if (inRange(addr, (u64)MemoryBase::BootROM, (u64)MemorySize::EDRAM)) {
-        std::memcpy(&data, &sharedRAM[addr & ((u32)MemorySize::EDRAM - 1)], sizeof(u32));
     } else {
         switch (addr) {
             case 0x1C200000:
@@ -568,57 +1002,77 @@ u32 meRead32(u32 addr) {
                 exit(0);
         }
     }
-
-    return data;
 }
 
 void meWrite8(u32 addr, u8 data) {
     addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
 
-    if (inRange(addr, (u64)MemoryBase::MESPRAM, (u64)MemorySize::EDRAM)) {
-        meSPRAM[addr & ((u32)MemorySize::EDRAM - 1)] = data;
-    } else if (inRange(addr, (u64)MemoryBase::DRAM, (u64)MemorySize::DRAM)) {
-        dram[addr & ((u32)MemorySize::DRAM - 1)] = data;
-    } else if (inRange(addr, (u64)MemoryBase::BootROM, (u64)MemorySize::EDRAM)) {
-        sharedRAM[addr & ((u32)MemorySize::EDRAM - 1)] = data;
-    } else {
-        switch (addr) {
-            default:
-                std::printf("Unhandled ME write8 @ 0x%08X = 0x%02X\n", addr, data);
+    if (const auto mem = getPage(mePageTable, addr)) {
+        journalWrite(mem, &data, sizeof(u8));
 
-                exit(0);
-        }
+        *mem = data;
+
+        checkCode(mem);
+
+        return;
+    }
+
+    beginIO(CPUID_ME, addr);
+
+    const auto ioLock = lockIO();
+
+    switch (addr) {
+        default:
+            std::printf("Unhandled ME write8 @ 0x%08X = 0x%02X\n", addr, data);
+
+            exit(0);
     }
 }
 
 void meWrite16(u32 addr, u16 data) {
     addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
 
-    if (inRange(addr, (u64)MemoryBase::MESPRAM, (u64)MemorySize::EDRAM)) {
-        std::memcpy(&meSPRAM[addr & ((u32)MemorySize::EDRAM - 1)], &data, sizeof(u16));
-    } else if (inRange(addr, (u64)MemoryBase::DRAM, (u64)MemorySize::DRAM)) {
-        std::memcpy(&dram[addr & ((u32)MemorySize::DRAM - 1)], &data, sizeof(u16));
-    } else if (inRange(addr, (u64)MemoryBase::BootROM, (u64)MemorySize::EDRAM)) {
-        std::memcpy(&sharedRAM[addr & ((u32)MemorySize::EDRAM - 1)], &data, sizeof(u16));
-    } else {
-        switch (addr) {
-            default:
-                std::printf("Unhandled ME write16 @ 0x%08X = 0x%04X\n", addr, data);
+    if (const auto mem = getPage(mePageTable, addr)) {
+        journalWrite(mem, &data, sizeof(u16));
 
-                exit(0);
-        }
+        std::memcpy(mem, &data, sizeof(u16));
+
+        checkCode(mem);
+
+        return;
+    }
+
+    beginIO(CPUID_ME, addr);
+
+    const auto ioLock = lockIO();
+
+    switch (addr) {
+        default:
+            std::printf("Unhandled ME write16 @ 0x%08X = 0x%04X\n", addr, data);
+
+            exit(0);
     }
 }
 
 void meWrite32(u32 addr, u32 data) {
     addr &= (u32)MemoryBase::PAddrSpace - 1; // Mask virtual address
 
-    if (inRange(addr, (u64)MemoryBase::MESPRAM, (u64)MemorySize::EDRAM)) {
-        std::memcpy(&meSPRAM[addr & ((u32)MemorySize::EDRAM - 1)], &data, sizeof(u32));
-    } else if (inRange(addr, (u64)MemoryBase::VME0, (u64)MemorySize::VME0)) {
+    if (const auto mem = getPage(mePageTable, addr)) {
+        journalWrite(mem, &data, sizeof(u32));
+
+        std::memcpy(mem, &data, sizeof(u32));
+
+        checkCode(mem);
+
+        return;
+    }
+
+    beginIO(CPUID_ME, addr);
+
+    const auto ioLock = lockIO();
+
+    if (inRange(addr, (u64)MemoryBase::VME0, (u64)MemorySize::VME0)) {
         std::printf("[VME     ] Unhandled write @ 0x%08X = 0x%08X\n", addr, data);
-    } else if (inRange(addr, (u64)MemoryBase::DRAM, (u64)MemorySize::DRAM)) {
-        std::memcpy(&dram[addr & ((u32)MemorySize::DRAM - 1)], &data, sizeof(u32));
     } else if (inRange(addr, (u64)MemoryBase::MEMPROT, (u64)MemorySize::MEMPROT)) {
         std::printf("[MEMPROT ] Unhandled write @ 0x%08X = 0x%08X\n", addr, data);
     } else if (inRange(addr, (u64)MemoryBase::SysCon, (u64)MemorySize::SysCon)) {
@@ -627,8 +1081,6 @@ void meWrite32(u32 addr, u32 data) {
         return intc::write(CPUID_ME, addr, data);
     } else if (inRange(addr, (u64)MemoryBase::VME1, (u64)MemorySize::VME1)) {
         std::printf("[VME     ] Unhandled write @ 0x%08X = 0x%08X\n", addr, data);
-    } else if (inRange(addr, (u64)MemoryBase::BootROM, (u64)MemorySize::EDRAM)) {
-        std::memcpy(&sharedRAM[addr & ((u32)MemorySize::EDRAM - 1)], &data, sizeof(u32));
     } else {
         switch (addr) {
             case 0x1C200000:
@@ -650,8 +1102,12 @@ void meWrite32(u32 addr, u32 data) {
 }
 
 void unmapBootROM() {
-    resetVector = sharedRAM.data();
+    resetVector = sharedRAM;
     resetSize = (u32)MemorySize::EDRAM;
+
+    mapCPUPages();
+    mapCodeAliases();
+    protectCodePages();
 }
 
 }
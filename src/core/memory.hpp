@@ -5,6 +5,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "../common/types.hpp"
 
 namespace psp::memory {
@@ -82,10 +84,55 @@ enum class MemorySize {
     NANDBuffer = 0x910,
 };
 
+// RAM write recorded by the journal
+struct JournalEntry {
+    u8 *mem;
+    u32 size;
+    u8 oldData[16], newData[16];
+};
+
 void init(const char *bootPath);
 
 u8 *getMemoryPointer(u32 addr);
 
+// Returns the host pointer of a RAM address whose mapping never changes, NULL otherwise
+u8 *getFixedPointer(bool isME, u32 addr);
+
+// Returns the host pointer of the RAM currently mapped at addr, NULL for devices
+u8 *getMappedPointer(bool isME, u32 addr);
+
+// Returns true if addr is handled by a device and never becomes RAM
+bool isFixedDevice(bool isME, u32 addr);
+
+// Writes to a pointer returned by getFixedPointer, same as a RAM write through the write handlers
+void writeFixed(u8 *mem, const void *data, u32 size);
+
+// Fastmem views mirror the physical address space, device pages fault on access
+u8 *getFastmemBase(bool isME);
+
+bool isFastmemAddress(const void *addr);
+
+// Records RAM writes made through the write handlers until endJournal is called
+void beginJournal();
+const std::vector<JournalEntry> &endJournal();
+
+// Restores the RAM contents overwritten by the recorded writes
+void rollbackJournal(const std::vector<JournalEntry> &entries);
+
+constexpr u32 IO_REGION_SHIFT = 20;
+
+// Returns the number of device reads and writes made by a core
+u64 getIOCount(bool isME);
+
+// Returns the number of device accesses to the 1 MiB region at addr, made by both cores
+u64 getIORegionCount(u32 addr);
+
+// Flags the RAM page at addr as holding decoded code, writes to it invalidate its blocks
+void markCode(bool isME, u32 addr);
+
+// Invalidates code in a CPU address range written without the write handlers
+void invalidateCode(u32 addr, u32 size);
+
 // Allegrex read/write handlers
 u8  read8 (u32 addr);
 u16 read16(u32 addr);
@@ -155,13 +155,13 @@ void finishErase() {
 void startTransfer() {
     deviceStatus &= ~(u32)NANDStatus::DEVICE_READY;
 
-    scheduler::addEvent(idFinishTransfer, 0, NAND_OP_CYCLES);
+    scheduler::addDeviceEvent(idFinishTransfer, 0, NAND_OP_CYCLES);
 }
 
 void startErase() {
     deviceStatus &= ~(u32)NANDStatus::DEVICE_READY;
 
-    scheduler::addEvent(idFinishErase, 0, NAND_OP_CYCLES); // Normally takes ~1.7 ms
+    scheduler::addDeviceEvent(idFinishErase, 0, NAND_OP_CYCLES); // Normally takes ~1.7 ms
 }
 
 void doCommand(u8 cmd) {
@@ -262,7 +262,7 @@ void write(u32 addr, u32 data) {
             std::printf("[NAND    ] Write @ STATUS = 0x%08X\n", data);
 
             if (!(deviceStatus & (u32)NANDStatus::NOT_WRITE_PROTECTED) && (data & (u32)NANDStatus::NOT_WRITE_PROTECTED)) {
-                scheduler::addEvent(idUnlockNand, 0, 1000);
+                scheduler::addDeviceEvent(idUnlockNand, 0, 1000);
             }
             break;
         case NANDReg::COMMAND:
@@ -5,9 +5,16 @@
 
 #include "psp.hpp"
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
 
 #include "ata.hpp"
+#include "config.hpp"
 #include "display.hpp"
 #include "dmacplus.hpp"
 #include "ge.hpp"
@@ -20,9 +27,12 @@
 #include "syscon.hpp"
 #include "systime.hpp"
 #include "allegrex/allegrex.hpp"
+#include "allegrex/blockcache.hpp"
 #include "allegrex/interpreter.hpp"
+#include "allegrex/jit.hpp"
 #include "crypto/kirk.hpp"
 #include "crypto/spock.hpp"
+#include "../common/file.hpp"
 
 #include <SDL2/SDL.h>
 
@@ -46,8 +56,78 @@ SDL_Event event;
 
 auto isRunning = true;
 
+u64 frameCount = 0;
+
+u64 instrCount[2]; // CPU, ME
+
+constexpr u32 GUEST_EXIT_MAGIC = 0xC0DEDBAD;
+
+std::array<u8, 4 * SCR_WIDTH * SCR_HEIGHT> lastFrame;
+
 Allegrex cpu, me;
 
+// CPU engine, selected on startup. Engines run until the end of the current slice
+void (*runCore)(Allegrex *);
+
+// Media Engine host thread, only used with --me-thread
+struct METhread {
+    std::thread thread;
+
+    // Slice handshake, the ME runs slice N while startSeq == N and doneSeq == N - 1
+    std::atomic<u64> startSeq, doneSeq;
+
+    // Work left for the slice boundary by the thread that doesn't own the target core
+    std::atomic<bool> irqPending, resetPending;
+
+    // Set before the last startSeq increment, isRunning can change in the middle of a slice
+    std::atomic<bool> isStopping;
+};
+
+METhread meThread;
+
+thread_local bool onMEThread = false;
+
+bool isSliceRunning = false; // Set while the ME thread runs a slice, main thread only
+
+Allegrex *runningCore = NULL; // Core currently executing a serial slice
+
+// Spins until counter reaches value, slices are too short to sleep on
+void waitFor(const std::atomic<u64> &counter, u64 value) {
+    while (counter.load(std::memory_order_acquire) < value) std::this_thread::yield();
+}
+
+// Runs a core's part of the slice, later events can't shorten the slice below the cycles it ran
+void runSlice(Allegrex *allegrex) {
+    runCore(allegrex);
+
+    scheduler::addSliceProgress(allegrex->cycles << interpreter::getClockShift(allegrex));
+}
+
+void meThreadMain() {
+    onMEThread = true;
+
+    for (u64 seq = 1;; seq++) {
+        waitFor(meThread.startSeq, seq);
+
+        if (meThread.isStopping.load(std::memory_order_relaxed)) return;
+
+        runSlice(&me);
+
+        meThread.doneSeq.store(seq, std::memory_order_release);
+    }
+}
+
+void stopMEThread() {
+    if (!meThread.thread.joinable()) return;
+
+    // The ME thread can't join itself, this happens when it hits a fatal error
+    if (onMEThread) return meThread.thread.detach();
+
+    meThread.isStopping.store(true, std::memory_order_relaxed);
+    meThread.startSeq.fetch_add(1, std::memory_order_release);
+    meThread.thread.join();
+}
+
 void sdlInit() {
     SDL_Init(SDL_INIT_VIDEO);
     SDL_SetHint(SDL_HINT_RENDER_VSYNC, "1");
@@ -61,18 +141,62 @@ void sdlInit() {
     screen.texture = SDL_CreateTexture(screen.renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, SCR_WIDTH, SCR_HEIGHT);
 }
 
-void init(const char *bootPath, const char *nandPath, const char *umdPath) {
-    sdlInit();
+// Lock-step checking rolls back RAM writes, so they all have to go through the memory functions
+void initLockstep() {
+    if (!config::lockstep) return;
 
-    memory::init(bootPath);
-    nand::init(nandPath);
+    std::puts("[PSP     ] Lock-step checking against the interpreter, fastmem and the ME thread are disabled");
+
+    config::fastmem = false;
+    config::meThread = false;
+
+    if (config::cpuEngine == config::CPUEngine::Interpreter) {
+        std::puts("[PSP     ] Lock-step checking needs a block engine, nothing will be checked");
+    }
+}
 
+void initCores() {
     cpu.init(Type::Allegrex);
     me.init(Type::MediaEngine);
 
     // MediaEngine is booted later on
     me.isHalted = true;
 
+    if (config::blockCachePath != NULL) blockcache::loadProfiles(config::blockCachePath);
+
+    switch (config::cpuEngine) {
+        case config::CPUEngine::CachedInterpreter:
+            std::puts("[PSP     ] Using cached interpreter");
+
+            runCore = &interpreter::runCached;
+            break;
+        case config::CPUEngine::JIT:
+            if (jit::init()) {
+                std::puts("[PSP     ] Using JIT");
+
+                runCore = &jit::run;
+            } else {
+                std::puts("[PSP     ] JIT unavailable, using interpreter");
+
+                runCore = &interpreter::run;
+            }
+            break;
+        case config::CPUEngine::Tiered:
+            if (jit::init()) {
+                std::puts("[PSP     ] Using tiered execution");
+            } else {
+                std::puts("[PSP     ] JIT unavailable, tiered execution stops at the cached interpreter");
+            }
+
+            runCore = &jit::runTiered;
+            break;
+        default:
+            runCore = &interpreter::run;
+            break;
+    }
+}
+
+void initDevices(const char *umdPath) {
     display::init();
     dmacplus::init();
     ge::init();
@@ -84,21 +208,213 @@ void init(const char *bootPath, const char *nandPath, const char *umdPath) {
     systime::init();
     ata::init(umdPath);
 
+    if (config::meThread) {
+        std::puts("[PSP     ] Running the ME on its own thread");
+
+        meThread.thread = std::thread(meThreadMain);
+
+        // Fatal errors call exit(), a joinable std::thread would terminate the process on destruction
+        std::atexit(stopMEThread);
+    }
+}
+
+void init(const char *bootPath, const char *nandPath, const char *umdPath) {
+    if (config::headless) {
+        std::puts("[PSP     ] Running headless");
+    } else {
+        sdlInit();
+    }
+
+    initLockstep();
+
+    memory::init(bootPath);
+    nand::init(nandPath);
+
+    initCores();
+    initDevices(umdPath);
+
     std::puts("[PSP     ] OK");
 }
 
+// Copies the guest binary to DRAM
+void loadGuest(const char *path, u32 addr) {
+    std::printf("[PSP     ] Loading guest binary \"%s\" @ 0x%08X\n", path, addr);
+
+    const auto file = std::fopen(path, "rb");
+
+    if (file == NULL) {
+        std::printf("[PSP     ] Unable to open guest binary \"%s\"\n", path);
+
+        exit(0);
+    }
+
+    std::fseek(file, 0, SEEK_END);
+    const auto size = (u64)std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+
+    const auto paddr = addr & ((u32)memory::MemoryBase::PAddrSpace - 1);
+
+    if ((paddr < (u32)memory::MemoryBase::DRAM) || ((paddr + size) > ((u64)memory::MemoryBase::DRAM + (u64)memory::MemorySize::DRAM))) {
+        std::printf("[PSP     ] Guest binary doesn't fit in DRAM @ 0x%08X\n", addr);
+
+        exit(0);
+    }
+
+    std::fread(memory::getMemoryPointer(addr), sizeof(u8), size, file);
+    std::fclose(file);
+}
+
+void initGuest() {
+    // Guest runs are batch runs
+    config::headless = true;
+
+    initLockstep();
+
+    memory::init(NULL);
+
+    loadGuest(config::guestPath, config::guestAddr);
+
+    initCores();
+
+    cpu.setPC(config::guestAddr);
+
+    initDevices(NULL);
+
+    std::puts("[PSP     ] OK");
+}
+
+// Returns true if a core can't make progress until an event happens
+bool isWaiting(Allegrex *allegrex) {
+    return allegrex->isHalted || allegrex->isIdle;
+}
+
+// Skips to the next scheduler event, this includes COP0 timer interrupts
+void skipIdleCycles() {
+    scheduler::run(scheduler::getCyclesUntilNextEvent());
+}
+
+// Applies interrupt changes and resets that were posted while the ME thread was running
+void syncME() {
+    if (meThread.resetPending.exchange(false)) resetME();
+
+    if (meThread.irqPending.exchange(false)) intc::checkInterrupts();
+}
+
+// Runs the CPU and the ME in parallel, returns at the slice boundary
+void runParallel() {
+    isSliceRunning = true;
+
+    const auto seq = meThread.startSeq.fetch_add(1, std::memory_order_release) + 1;
+
+    runSlice(&cpu);
+
+    waitFor(meThread.doneSeq, seq);
+
+    isSliceRunning = false;
+
+    syncME();
+}
+
+// Bitwise CRC-32 (IEEE), only used once per run
+u32 crc32(const u8 *data, u64 size) {
+    u32 crc = ~0U;
+
+    for (u64 i = 0; i < size; i++) {
+        crc ^= data[i];
+
+        for (int j = 0; j < 8; j++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+
+    return ~crc;
+}
+
+// Reports instruction, event and device access counts of a guest run
+void reportGuest(double hostSeconds) {
+    const auto totalInstrs = instrCount[0] + instrCount[1];
+
+    std::printf("[PSP     ] Guest stopped @ 0x%08X after %llu instructions (CPU: %llu, ME: %llu)\n", cpu.getPC(), (unsigned long long)totalInstrs, (unsigned long long)instrCount[0], (unsigned long long)instrCount[1]);
+    std::printf("[PSP     ] Host time: %.3f s, %.2f MIPS\n", hostSeconds, (1E-6 * totalInstrs) / hostSeconds);
+    std::printf("[PSP     ] Scheduler events: %llu, device accesses: %llu\n", (unsigned long long)scheduler::getEventCount(), (unsigned long long)(memory::getIOCount(false) + memory::getIOCount(true)));
+
+    // RAM accesses take the page table fast path and aren't counted
+    for (u64 addr = 0; addr < (u64)memory::MemoryBase::PAddrSpace; addr += (u64)1 << memory::IO_REGION_SHIFT) {
+        if (const auto count = memory::getIORegionCount((u32)addr)) {
+            std::printf("[PSP     ]   0x%08llX: %llu\n", (unsigned long long)addr, (unsigned long long)count);
+        }
+    }
+}
+
+// Reports the last frame of a run, writes it to the dump path if one was given
+void finishRun() {
+    std::printf("[PSP     ] Stopped after %llu frames, %lld cycles, frame CRC32: 0x%08X\n", (unsigned long long)frameCount, (long long)scheduler::getTimestamp(), crc32(lastFrame.data(), lastFrame.size()));
+
+    if (config::dumpPath != NULL) writeFile(config::dumpPath, lastFrame.data(), lastFrame.size());
+}
+
 void run() {
+    const auto startTime = std::chrono::steady_clock::now();
+
     while (isRunning) {
-        const auto runCycles = scheduler::getRunCycles();
+        if ((config::maxCycles != 0) && (scheduler::getTimestamp() >= config::maxCycles)) break;
+
+        // Guest binaries end with HALT or a magic UART0 write
+        if ((config::guestPath != NULL) && cpu.isHalted) break;
+
+        // Only an interrupt can wake up halted cores, dispatch events without running empty slices
+        if (cpu.isHalted && me.isHalted) {
+            skipIdleCycles();
+
+            continue;
+        }
+
+        // Starts a slice that lasts until the next event, engines read its length from the scheduler
+        scheduler::getRunCycles();
+
+        if (config::meThread) {
+            runParallel();
+        } else {
+            runningCore = &cpu;
+            runSlice(&cpu);
+
+            runningCore = &me;
+            runSlice(&me);
+
+            runningCore = NULL;
+        }
+
+        instrCount[0] += cpu.cycles;
+        instrCount[1] += me.cycles;
+
+        // The slice may have been shortened by a device, but not below the cycles the cores ran
+        scheduler::endSlice();
+
+        if (isWaiting(&cpu) && isWaiting(&me)) skipIdleCycles();
+    }
+
+    stopMEThread();
 
-        interpreter::run(&cpu, runCycles);
-        interpreter::run(&me , runCycles >> 1);
+    if (config::blockCachePath != NULL) blockcache::saveProfiles(config::blockCachePath);
 
-        scheduler::run(runCycles);
+    if (config::guestPath != NULL) {
+        reportGuest(std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count());
+    } else {
+        finishRun();
     }
 }
 
+void stop() {
+    isRunning = false;
+}
+
 void update(u8 *fb) {
+    std::memcpy(lastFrame.data(), fb, lastFrame.size());
+
+    frameCount++;
+
+    if ((config::maxFrames != 0) && (frameCount >= config::maxFrames)) isRunning = false;
+
+    if (config::headless) return;
+
     while (SDL_PollEvent(&event)) {
         switch (event.type) {
             case SDL_QUIT:
@@ -114,11 +430,60 @@ void update(u8 *fb) {
     SDL_RenderPresent(screen.renderer);
 }
 
+// Dispatches events that are due before the current instruction of the running core
+void catchUp(bool isME) {
+    // Cores on different threads only sync at slice boundaries
+    if (config::meThread) return;
+
+    const auto allegrex = isME ? &me : &cpu;
+
+    if (allegrex != runningCore) return;
+
+    scheduler::catchUp(allegrex->cycles << interpreter::getClockShift(allegrex));
+}
+
+// Returns true if a core is executing its part of the current slice
+bool isCoreRunning(bool isME) {
+    if (onMEThread) return isME;
+
+    if (config::meThread) return !isME && isSliceRunning;
+
+    return runningCore == (isME ? &me : &cpu);
+}
+
+i64 getCoreTimestamp(bool isME) {
+    // Cores outside of their slice are at the slice boundary
+    if (!isCoreRunning(isME)) return scheduler::getTimestamp();
+
+    const auto allegrex = isME ? &me : &cpu;
+
+    return scheduler::getCoreTimestamp((allegrex->cycles + allegrex->blockCycles) << interpreter::getClockShift(allegrex));
+}
+
+bool ownsCore(bool isME) {
+    if (onMEThread) return isME;
+
+    return !isME || !isSliceRunning;
+}
+
+// Interrupt lines of a core that's running on another thread are updated at the slice boundary
 void setIRQPending(bool irqPending) {
+    if (!ownsCore(false)) {
+        meThread.irqPending = true;
+
+        return;
+    }
+
     cpu.setIRQPending(irqPending);
 }
 
 void meSetIRQPending(bool irqPending) {
+    if (!ownsCore(true)) {
+        meThread.irqPending = true;
+
+        return;
+    }
+
     me.setIRQPending(irqPending);
 }
 
@@ -126,14 +491,38 @@ void resetCPU() {
     cpu.reset();
 
     memory::unmapBootROM();
+
+    blockcache::invalidateAll(&cpu);
 }
 
 void resetME() {
+    if (!ownsCore(true)) {
+        meThread.resetPending = true;
+
+        return;
+    }
+
     me.reset();
+
+    // New ME code has been loaded at this point
+    blockcache::invalidateAll(&me);
 }
 
 void postME() {
     intc::meSendIRQ(intc::InterruptSource::ME_VME);
 }
 
+bool isGuestExit(u32 data) {
+    return (config::guestPath != NULL) && (data == GUEST_EXIT_MAGIC);
+}
+
+void exitGuest() {
+    // Engines check isHalted after every device access
+    const auto allegrex = (onMEThread || (runningCore == &me)) ? &me : &cpu;
+
+    allegrex->isHalted = true;
+
+    isRunning = false;
+}
+
 }
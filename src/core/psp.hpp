@@ -10,10 +10,20 @@
 namespace psp {
 
 void init(const char *bootPath, const char *nandPath, const char *umdPath);
+void initGuest();
 void run();
+void stop();
 
 void update(u8 *fb);
 
+// Returns true if the calling thread may access a core's state
+bool ownsCore(bool isME);
+
+void catchUp(bool isME);
+
+// Returns the scheduler time at the current instruction of a core
+i64 getCoreTimestamp(bool isME);
+
 void setIRQPending(bool irqPending);
 void meSetIRQPending(bool irqPending);
 
@@ -22,4 +32,10 @@ void resetME();
 
 void postME();
 
+// Returns true if a UART0 write ends a guest run
+bool isGuestExit(u32 data);
+
+// Halts the core that wrote the exit magic, it stops at the write like it does on HALT
+void exitGuest();
+
 }
@@ -5,68 +5,337 @@
 
 #include "scheduler.hpp"
 
+#include <algorithm>
 #include <cassert>
-#include <queue>
+#include <mutex>
 #include <vector>
 
+#include "config.hpp"
+
 namespace psp::scheduler {
 
-constexpr i64 MAX_RUN_CYCLES = 256;
+constexpr i64 MAX_RUN_CYCLES = 256; // Slice length if no event is pending
+
+constexpr u32 HEAP_ARITY = 4;
 
-// Scheduler event
+// Scheduler event, lives in a slot while it's pending
 struct Event {
     u64 id;
     int param;
 
     i64 timestamp;
+    u64 seq; // Events with the same timestamp fire in the order they were added
 
-    bool operator>(const Event &other) const {
-        return timestamp > other.timestamp;
-    }
+    u32 heapIdx;
+    u32 generation; // Incremented when the slot is freed, stale handles don't match
+    bool isPending;
 };
 
-// Event queue
-std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+std::vector<Event> slots;
+std::vector<u32> freeSlots;
+
+// Indexed 4-ary min-heap of pending slots
+std::vector<u32> heap;
 
-std::vector<std::function<void(int)>> registeredFuncs;
+std::vector<EventFunc> registeredFuncs;
 
 i64 globalTimestamp = 0;
+i64 sliceStart = 0;
 
-// Registers an event, returns event ID
-u64 registerEvent(std::function<void(int)> func) {
-    static u64 idPool;
+u64 eventCount = 0; // Number of dispatched events
+
+bool isDispatching = false; // Device accesses made by event handlers must not dispatch events
+
+std::atomic<i64> sliceCycles = MAX_RUN_CYCLES;
+
+// Furthest position a core has reached in the current slice, the slice can't end before it
+std::atomic<i64> sliceProgress = 0;
+
+// Events may be added by the ME thread while the CPU runs, they're only dispatched at slice boundaries
+std::mutex eventMutex;
+
+u64 seqPool = 0;
+
+bool isEarlier(u32 a, u32 b) {
+    const auto &eventA = slots[a];
+    const auto &eventB = slots[b];
+
+    if (eventA.timestamp != eventB.timestamp) return eventA.timestamp < eventB.timestamp;
+
+    return eventA.seq < eventB.seq;
+}
+
+void place(u32 idx, u32 slot) {
+    heap[idx] = slot;
+
+    slots[slot].heapIdx = idx;
+}
+
+void siftUp(u32 idx) {
+    const auto slot = heap[idx];
+
+    while (idx > 0) {
+        const auto parent = (idx - 1) / HEAP_ARITY;
+
+        if (!isEarlier(slot, heap[parent])) break;
+
+        place(idx, heap[parent]);
+
+        idx = parent;
+    }
+
+    place(idx, slot);
+}
+
+void siftDown(u32 idx) {
+    const auto slot = heap[idx];
+    const auto size = (u32)heap.size();
+
+    while (true) {
+        const auto first = HEAP_ARITY * idx + 1;
+
+        if (first >= size) break;
+
+        auto child = first;
+
+        for (auto i = first + 1; i < std::min(first + HEAP_ARITY, size); i++) {
+            if (isEarlier(heap[i], heap[child])) child = i;
+        }
+
+        if (!isEarlier(heap[child], slot)) break;
 
+        place(idx, heap[child]);
+
+        idx = child;
+    }
+
+    place(idx, slot);
+}
+
+// Removes the event at heap index idx and frees its slot
+void removeAt(u32 idx) {
+    const auto slot = heap[idx];
+    const auto last = heap.back();
+
+    heap.pop_back();
+
+    if (idx < heap.size()) {
+        place(idx, last);
+
+        siftDown(idx);
+        siftUp(slots[last].heapIdx);
+    }
+
+    auto &event = slots[slot];
+
+    event.isPending = false;
+    event.generation++;
+
+    freeSlots.push_back(slot);
+}
+
+// Ends the current slice early if an event was added before its end, cycles that already ran are kept
+void clampSlice(i64 timestamp) {
+    const auto cycles = std::max({timestamp - sliceStart, sliceProgress.load(std::memory_order_relaxed), (i64)1});
+
+    if (cycles < sliceCycles.load(std::memory_order_relaxed)) sliceCycles.store(cycles, std::memory_order_relaxed);
+}
+
+EventHandle makeHandle(u32 slot) {
+    return ((u64)slots[slot].generation << 32) | slot;
+}
+
+// Returns the slot of a pending event, -1 if the handle is stale
+i64 getSlot(EventHandle handle) {
+    const auto slot = (u32)handle;
+
+    if ((handle == NO_EVENT) || (slot >= slots.size())) return -1;
+
+    const auto &event = slots[slot];
+
+    if (!event.isPending || (event.generation != (u32)(handle >> 32))) return -1;
+
+    return slot;
+}
+
+// Registers an event, returns event ID
+u64 registerEvent(EventFunc func) {
     registeredFuncs.push_back(func);
 
-    return idPool++;
+    return registeredFuncs.size() - 1;
 }
 
 // Adds a scheduler event
-void addEvent(u64 id, int param, i64 cyclesUntilEvent) {
+EventHandle addEvent(u64 id, int param, i64 cyclesUntilEvent) {
     assert(cyclesUntilEvent > 0);
 
-    events.emplace(Event{id, param, globalTimestamp + cyclesUntilEvent});
+    std::lock_guard lock(eventMutex);
+
+    u32 slot;
+
+    if (freeSlots.empty()) {
+        slot = (u32)slots.size();
+
+        slots.emplace_back(Event{});
+    } else {
+        slot = freeSlots.back();
+
+        freeSlots.pop_back();
+    }
+
+    auto &event = slots[slot];
+
+    event.id = id;
+    event.param = param;
+    event.timestamp = globalTimestamp + cyclesUntilEvent;
+    event.seq = seqPool++;
+    event.isPending = true;
+
+    heap.push_back(slot);
+
+    siftUp((u32)heap.size() - 1);
+
+    clampSlice(event.timestamp);
+
+    return makeHandle(slot);
+}
+
+EventHandle addDeviceEvent(u64 id, int param, i64 cyclesUntilEvent) {
+    switch (config::timing) {
+        case config::Timing::Fast:
+            cyclesUntilEvent = std::max(cyclesUntilEvent >> 4, (i64)1);
+            break;
+        case config::Timing::Instant:
+            cyclesUntilEvent = 1;
+            break;
+        default:
+            break;
+    }
+
+    return addEvent(id, param, cyclesUntilEvent);
+}
+
+bool cancelEvent(EventHandle handle) {
+    std::lock_guard lock(eventMutex);
+
+    const auto slot = getSlot(handle);
+
+    if (slot < 0) return false;
+
+    removeAt(slots[slot].heapIdx);
+
+    return true;
+}
+
+bool rescheduleEvent(EventHandle handle, i64 cyclesUntilEvent) {
+    assert(cyclesUntilEvent > 0);
+
+    std::lock_guard lock(eventMutex);
+
+    const auto slot = getSlot(handle);
+
+    if (slot < 0) return false;
+
+    auto &event = slots[slot];
+
+    event.timestamp = globalTimestamp + cyclesUntilEvent;
+    event.seq = seqPool++;
+
+    const auto idx = event.heapIdx;
+
+    siftDown(idx);
+    siftUp(slots[slot].heapIdx);
+
+    clampSlice(slots[slot].timestamp);
+
+    return true;
+}
+
+bool isPending(EventHandle handle) {
+    std::lock_guard lock(eventMutex);
+
+    return getSlot(handle) >= 0;
+}
+
+i64 getTimestamp() {
+    return globalTimestamp;
+}
+
+i64 getCoreTimestamp(i64 coreCycles) {
+    if (isDispatching) return globalTimestamp;
+
+    return std::max(globalTimestamp, sliceStart + coreCycles);
 }
 
 i64 getRunCycles() {
-    return MAX_RUN_CYCLES;
+    const auto runCycles = std::min(getCyclesUntilNextEvent(), config::maxSliceCycles);
+
+    sliceStart = globalTimestamp;
+    sliceCycles.store(runCycles, std::memory_order_relaxed);
+    sliceProgress.store(0, std::memory_order_relaxed);
+
+    return runCycles;
 }
 
-void run(i64 runCycles) {
-    const auto newTimestamp = globalTimestamp + runCycles;
+i64 getCyclesUntilNextEvent() {
+    if (heap.empty()) return MAX_RUN_CYCLES;
 
-    while (events.top().timestamp <= newTimestamp) {
-        globalTimestamp = events.top().timestamp;
+    return std::max(slots[heap[0]].timestamp - globalTimestamp, (i64)1);
+}
+
+// Dispatches all events up to newTimestamp
+void runUntil(i64 newTimestamp) {
+    if (isDispatching) return;
+
+    isDispatching = true;
+
+    while (!heap.empty() && (slots[heap[0]].timestamp <= newTimestamp)) {
+        const auto &event = slots[heap[0]];
 
-        const auto id = events.top().id;
-        const auto param = events.top().param;
+        globalTimestamp = event.timestamp;
 
-        events.pop();
+        const auto id = event.id;
+        const auto param = event.param;
+
+        removeAt(0);
+
+        eventCount++;
 
         registeredFuncs[id](param);
     }
 
-    globalTimestamp = newTimestamp;
+    isDispatching = false;
+
+    globalTimestamp = std::max(globalTimestamp, newTimestamp);
+}
+
+u64 getEventCount() {
+    return eventCount;
+}
+
+u64 getScheduleCount() {
+    return seqPool;
+}
+
+void run(i64 runCycles) {
+    runUntil(globalTimestamp + runCycles);
+}
+
+void addSliceProgress(i64 cycles) {
+    auto progress = sliceProgress.load(std::memory_order_relaxed);
+
+    while ((progress < cycles) && !sliceProgress.compare_exchange_weak(progress, cycles, std::memory_order_relaxed));
+}
+
+void catchUp(i64 sliceCycles) {
+    addSliceProgress(sliceCycles);
+
+    runUntil(sliceStart + sliceCycles);
+}
+
+void endSlice() {
+    // Cores may have run past a boundary that was moved after they started
+    runUntil(sliceStart + std::max(sliceCycles.load(std::memory_order_relaxed), sliceProgress.load(std::memory_order_relaxed)));
 }
 
 }
@@ -5,7 +5,7 @@
 
 #pragma once
 
-#include <functional>
+#include <atomic>
 
 #include "../common/types.hpp"
 
@@ -13,12 +13,61 @@ namespace psp::scheduler {
 
 constexpr i64 _1US = 333;
 
-u64 registerEvent(std::function<void(int)> func);
+// Event callback, captureless lambdas convert to this
+using EventFunc = void (*)(int);
 
-void addEvent(u64 id, int param, i64 cyclesUntilEvent);
+// Identifies one pending event, stale handles are ignored
+using EventHandle = u64;
 
+constexpr EventHandle NO_EVENT = ~(u64)0;
+
+u64 registerEvent(EventFunc func);
+
+EventHandle addEvent(u64 id, int param, i64 cyclesUntilEvent);
+
+// Schedules the completion of a peripheral operation, the delay is scaled by the timing profile
+EventHandle addDeviceEvent(u64 id, int param, i64 cyclesUntilEvent);
+
+// Returns false if the event isn't pending anymore
+bool cancelEvent(EventHandle handle);
+bool rescheduleEvent(EventHandle handle, i64 cyclesUntilEvent);
+
+bool isPending(EventHandle handle);
+
+// Starts a new slice that ends at the next event, returns its length
 i64 getRunCycles();
 
+// Records the position a core has reached in the current slice, in CPU cycles
+void addSliceProgress(i64 cycles);
+
+// Dispatches events up to a core's position in the current slice, in CPU cycles
+void catchUp(i64 sliceCycles);
+
+// Dispatches the remaining events of the current slice
+void endSlice();
+
+// Length of the current slice, shortened if an event is added before its end
+extern std::atomic<i64> sliceCycles;
+
+// Returns the length of the current slice for a core running at (CPU clock >> clockShift)
+inline i64 getSliceCycles(int clockShift) {
+    return sliceCycles.load(std::memory_order_relaxed) >> clockShift;
+}
+
+// Returns the current scheduler time in CPU cycles
+i64 getTimestamp();
+
+// Returns the time of a core that has run coreCycles CPU cycles of the current slice, the event time while events are dispatched
+i64 getCoreTimestamp(i64 coreCycles);
+
+u64 getEventCount();
+
+// Returns the number of events added or rescheduled so far
+u64 getScheduleCount();
+
+// Returns the number of cycles until the earliest pending event
+i64 getCyclesUntilNextEvent();
+
 void run(i64 runCycles);
 
 }
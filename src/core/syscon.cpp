@@ -792,7 +792,7 @@ void writeSerial(u32 addr, u32 data) {
                     clearTxQueue();
                     break;
                 case 6:
-                    scheduler::addEvent(idFinishCommand, 0, SYSCON_OP_CYCLES);
+                    scheduler::addDeviceEvent(idFinishCommand, 0, SYSCON_OP_CYCLES);
                     break;
                 default:
                     break;
@@ -23,31 +23,65 @@ enum class SysTimeReg {
     UNKNOWN2 = 0x1C600010,
 };
 
-u32 time, alarm;
+u32 alarm;
 
-u64 idClockSysTime;
+// TIME is derived from the scheduler timestamp, baseTime is the value of TIME at baseTimestamp
+u32 baseTime;
+i64 baseTimestamp;
 
-void clockSysTime() {
-    ++time;
+u64 idAlarm;
 
-    if (time == alarm) {
-        intc::sendIRQ(intc::InterruptSource::SysTime);
-    }
+scheduler::EventHandle alarmEvent = scheduler::NO_EVENT;
 
-    scheduler::addEvent(idClockSysTime, 0, SYSTIME_CYCLES);
+u32 getTime() {
+    return baseTime + (u32)((scheduler::getTimestamp() - baseTimestamp) / SYSTIME_CYCLES);
+}
+
+void setTime(u32 time) {
+    const auto now = scheduler::getTimestamp();
+
+    // Keep the tick phase, TIME increments every SYSTIME_CYCLES since init
+    baseTimestamp = now - ((now - baseTimestamp) % SYSTIME_CYCLES);
+    baseTime = time;
+}
+
+// Schedules the alarm interrupt at the tick where TIME becomes equal to ALARM
+void scheduleAlarm() {
+    scheduler::cancelEvent(alarmEvent);
+
+    const auto now = scheduler::getTimestamp();
+    const auto elapsedTicks = (now - baseTimestamp) / SYSTIME_CYCLES;
+
+    // TIME has to wrap around if it's already equal to ALARM
+    i64 ticks = (u32)(alarm - (baseTime + (u32)elapsedTicks));
+
+    if (ticks == 0) ticks = (i64)1 << 32;
+
+    alarmEvent = scheduler::addEvent(idAlarm, 0, baseTimestamp + (elapsedTicks + ticks) * SYSTIME_CYCLES - now);
+}
+
+void fireAlarm() {
+    alarmEvent = scheduler::NO_EVENT;
+
+    intc::sendIRQ(intc::InterruptSource::SysTime);
+
+    scheduleAlarm();
 }
 
 void init() {
-    idClockSysTime = scheduler::registerEvent([](int) {clockSysTime();});
+    idAlarm = scheduler::registerEvent([](int) {fireAlarm();});
+
+    baseTime = 0;
+    baseTimestamp = scheduler::getTimestamp();
 
-    scheduler::addEvent(idClockSysTime, 0, SYSTIME_CYCLES);
+    scheduleAlarm();
 }
 
 u32 read(u32 addr) {
     switch ((SysTimeReg)addr) {
         case SysTimeReg::TIME:
             std::printf("[SysTime ] Read @ TIME\n");
-            return time;
+            return getTime();
         case SysTimeReg::ALARM:
             std::printf("[SysTime ] Read @ ALARM\n");
             return alarm;
@@ -68,7 +102,9 @@ void write(u32 addr, u32 data) {
         case SysTimeReg::TIME:
             std::printf("[SysTime ] Write @ TIME = 0x%08X\n", data);
 
-            time = data;
+            setTime(data);
+
+            scheduleAlarm();
             break;
         case SysTimeReg::ALARM:
             std::printf("[SysTime ] Write @ ALARM = 0x%08X\n", data);
@@ -76,6 +112,8 @@ void write(u32 addr, u32 data) {
             alarm = data;
 
             intc::clearIRQ(intc::InterruptSource::SysTime);
+
+            scheduleAlarm();
             break;
         case SysTimeReg::UNKNOWN0:
         case SysTimeReg::UNKNOWN1:
@@ -4,20 +4,41 @@
  */
 
 #include <cstdio>
+#include <cstring>
 
+#include "core/config.hpp"
 #include "core/psp.hpp"
 
 int main(int argc, char **argv) {
-    if (argc < 3) {
-        std::puts("Usage: ChiSP boot.bin nand.bin [umd.iso]");
+    // Parse options, they come before the file arguments
+    int argIdx = 1;
+
+    for (; (argIdx < argc) && !std::strncmp(argv[argIdx], "--", 2); argIdx++) {
+        if (!psp::config::parseOption(argv[argIdx])) return -1;
+    }
+
+    if (psp::config::guestPath != NULL) {
+        psp::initGuest();
+        psp::run();
+
+        return 0;
+    }
+
+    const auto numArgs = argc - argIdx;
+
+    if (numArgs < 2) {
+        std::puts("Usage: ChiSP [options] boot.bin nand.bin [umd.iso]");
+        std::puts("       ChiSP [options] --guest=<binary>");
+
+        psp::config::printOptions();
 
         return -1;
     }
 
-    if (argc == 3) {
-        psp::init(argv[1], argv[2], NULL); // Last argument *can* be NULL!
+    if (numArgs == 2) {
+        psp::init(argv[argIdx], argv[argIdx + 1], NULL); // Last argument *can* be NULL!
     } else {
-        psp::init(argv[1], argv[2], argv[3]);
+        psp::init(argv[argIdx], argv[argIdx + 1], argv[argIdx + 2]);
     }
 
     psp::run();